@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+
+//Synthetic hunt generator for the benchmarks. Prints treasures in the
+//--add-batch format (user,latitude,longitude,value,clue); the same options
+//always give the same output. User k is picked with a weight of
+//1/(k+1)^skew, so skew 0 spreads treasures evenly over the users and
+//higher values give a few users most of them.
+
+//xorshift64*: small, and the same sequence on every platform
+static unsigned long long nextRandom(unsigned long long* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+//Uniform in [0, 1)
+static double nextUnit(unsigned long long* state)
+{
+    return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//First user whose cumulative weight is past pick
+static int pickUser(const double* cumulative, int users, double pick)
+{
+    int low = 0;
+    int high = users - 1;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (cumulative[middle] > pick)
+        {
+            high = middle;
+        }
+        else
+        {
+            low = middle + 1;
+        }
+    }
+    return low;
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct option longOptions[] = {
+        {"treasures", required_argument, NULL, 'n'},
+        {"users", required_argument, NULL, 'u'},
+        {"skew", required_argument, NULL, 's'},
+        {"seed", required_argument, NULL, 'r'},
+        {NULL, 0, NULL, 0}
+    };
+    long treasures = 100000;
+    int users = 1000;
+    double skew = 1.0;
+    unsigned long long seed = 1;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "n:u:s:r:", longOptions, NULL)) != -1)
+    {
+        if (opt == 'n')
+        {
+            treasures = atol(optarg);
+        }
+        else if (opt == 'u')
+        {
+            users = atoi(optarg);
+        }
+        else if (opt == 's')
+        {
+            skew = atof(optarg);
+        }
+        else if (opt == 'r')
+        {
+            seed = strtoull(optarg, NULL, 10);
+        }
+        else
+        {
+            treasures = -1;
+            break;
+        }
+    }
+    if (treasures < 0 || users < 1 || skew < 0 || optind != argc)
+    {
+        fprintf(stderr, "Usage: %s [--treasures N] [--users N] [--skew S] [--seed N]\n", argv[0]);
+        return 1;
+    }
+
+    double* cumulative = malloc(users * sizeof(double));
+    if (cumulative == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    double total = 0;
+    for (int user = 0; user < users; user++)
+    {
+        total += pow(user + 1, -skew);
+        cumulative[user] = total;
+    }
+
+    //A zero state would stay zero
+    unsigned long long state = seed ^ 0x9E3779B97F4A7C15ULL;
+    if (state == 0)
+    {
+        state = 1;
+    }
+
+    setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+    for (long i = 1; i <= treasures; i++)
+    {
+        int user = pickUser(cumulative, users, nextUnit(&state) * total);
+        double latitude = nextUnit(&state) * 180 - 90;
+        double longitude = nextUnit(&state) * 360 - 180;
+        int value = 1 + nextRandom(&state) % 1000;
+        printf("user%d,%.6f,%.6f,%d,clue %ld\n", user, latitude, longitude, value, i);
+    }
+
+    free(cumulative);
+    return fflush(stdout) == 0 ? 0 : 1;
+}
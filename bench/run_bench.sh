@@ -0,0 +1,161 @@
+#!/bin/bash
+# Benchmarks treasure_manager, score_calculator and treasure_hub on a hunt
+# made by hunt_generator, and writes the results to $BENCH_OUT as JSON.
+# The hunt is set with BENCH_TREASURES, BENCH_USERS, BENCH_SKEW and
+# BENCH_SEED; BENCH_OPS is how many single commands (add, view, remove)
+# each latency benchmark runs. Every run of the same settings works on
+# the same data, so results can be compared across commits.
+set -e
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TREASURES=${BENCH_TREASURES:-200000}
+USERS=${BENCH_USERS:-10000}
+SKEW=${BENCH_SKEW:-1.0}
+SEED=${BENCH_SEED:-1}
+OPS=${BENCH_OPS:-200}
+OUT=${BENCH_OUT:-$ROOT/bench/results.json}
+case $OUT in /*) ;; *) OUT=$PWD/$OUT ;; esac
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+export LC_ALL=C
+MANAGER=$ROOT/treasure_manager
+
+# Microseconds since the epoch, without forking
+now() {
+    NOW=${EPOCHREALTIME/./}
+}
+
+# Average, p50 and p99 in ms of the microsecond durations in a file
+latency_json() {
+    sort -n "$1" | awk '{ v[NR] = $1; sum += $1 } END {
+        printf ",\"latency_ms\":{\"average\":%.3f,\"p50\":%.3f,\"p99\":%.3f}",
+               sum / NR / 1000, v[int((NR - 1) * 0.50) + 1] / 1000, v[int((NR - 1) * 0.99) + 1] / 1000
+    }'
+}
+
+# record NAME OPS MICROSECONDS [EXTRA_JSON]: one benchmark result
+RESULTS=()
+record() {
+    local seconds
+    seconds=$(awk -v us="$3" 'BEGIN { printf "%.6f", us / 1e6 }')
+    RESULTS+=("$(awk -v name="$1" -v ops="$2" -v s="$seconds" -v extra="$4" 'BEGIN {
+        printf "{\"name\":\"%s\",\"ops\":%d,\"seconds\":%s,\"per_second\":%.1f%s}",
+               name, ops, s, (s > 0 ? ops / s : 0), extra
+    }')")
+    printf '%-16s %9d ops %10.3f s\n' "$1" "$2" "$seconds" >&2
+}
+
+# time_each NAME FILE COMMAND...: run COMMAND once per line of FILE with
+# the line's words appended, and record the throughput and latency
+time_each() {
+    local name=$1 list=$2 total=0 start ops=0
+    shift 2
+    : > durations
+    while read -r args; do
+        now; start=$NOW
+        "$@" $args > /dev/null
+        now
+        echo $((NOW - start)) >> durations
+        total=$((total + NOW - start))
+        ops=$((ops + 1))
+    done < "$list"
+    record "$name" "$ops" "$total" "$(latency_json durations)"
+}
+
+# The IDs of OPS treasures spread over the hunt, always the same ones
+awk -v n="$OPS" -v t="$TREASURES" 'BEGIN { for (i = 0; i < n; i++) print "bench", (i * 7919) % t + 1 }' > ids
+
+"$ROOT/bench/hunt_generator" --treasures "$TREASURES" --users "$USERS" --skew "$SKEW" --seed "$SEED" > hunt.csv
+
+# Adding: one batch import of the whole hunt
+now; start=$NOW
+"$MANAGER" --add-batch bench hunt.csv > /dev/null
+now
+record add_batch "$TREASURES" $((NOW - start))
+
+# Listing: full scans in text and compact form
+for form in text compact; do
+    flag=
+    [ $form = compact ] && flag=--compact
+    now; start=$NOW
+    for run in 1 2 3; do
+        "$MANAGER" --list bench $flag > /dev/null
+    done
+    now
+    record "list_$form" $((3 * TREASURES)) $((NOW - start))
+done
+
+# Viewing: single lookups through the ID index
+awk '{ print $2 }' ids > view_ids
+time_each view view_ids "$MANAGER" --view bench
+
+# Scoring: without the cache, on every CPU, then from the cache
+now; start=$NOW
+rm -f bench/scores.cache
+"$ROOT/score_calculator" bench > /dev/null
+now
+record score_cold "$TREASURES" $((NOW - start))
+
+now; start=$NOW
+rm -f bench/scores.cache
+"$ROOT/score_calculator" -j "$(nproc)" bench > /dev/null
+now
+record score_cold_parallel "$TREASURES" $((NOW - start))
+
+now; start=$NOW
+for run in 1 2 3; do
+    "$ROOT/score_calculator" bench > /dev/null
+done
+now
+record score_cached $((3 * TREASURES)) $((NOW - start))
+
+# Hub round trips: batch mode reports the latency of every command. The
+# final stop_monitor counts among them, and its half-second wait is part
+# of the seconds recorded, so track these by their latency.
+hub_batch() {
+    local name=$1 commands=$2 start
+    now; start=$NOW
+    "$ROOT/treasure_hub" -f "$commands" > /dev/null 2> hub.err
+    now
+    local answered
+    answered=$(sed -n 's/^Batch: [0-9]* commands, \([0-9]*\) answered.*/\1/p' hub.err)
+    record "$name" "${answered:-0}" $((NOW - start)) "$(sed -n \
+        's/^Latency: average \([0-9.]*\) ms, p50 \([0-9.]*\) ms, p99 \([0-9.]*\) ms.*/,"latency_ms":{"average":\1,"p50":\2,"p99":\3}/p' hub.err)"
+}
+{ echo start_monitor; for run in 1 2 3 4 5; do sed 's/^/view_treasure /' ids; done; } > hub_view.txt
+hub_batch hub_view hub_view.txt
+{ echo start_monitor; for ((i = 0; i < OPS; i++)); do echo calculate_score bench; done; } > hub_score.txt
+hub_batch hub_score hub_score.txt
+
+# Single adds, each one a process that locks, appends and commits
+for ((i = 0; i < OPS; i++)); do echo; done > add_list
+add_one() {
+    printf 'bench%d\n45.5\n25.5\nbenchmark clue\n%d\n' $((RANDOM % 100)) $((RANDOM % 1000 + 1)) | "$MANAGER" --add bench
+}
+RANDOM=$SEED
+time_each add add_list add_one
+
+# Removing: tombstones, then the compaction that drops them. --compact
+# only rewrites a hunt with a quarter of it removed, so this works on a
+# hunt of 3 * OPS treasures and removes every third one.
+head -n $((3 * OPS)) hunt.csv > churn.csv
+"$MANAGER" --add-batch churn churn.csv > /dev/null
+awk -v n="$OPS" 'BEGIN { for (i = 1; i <= n; i++) print 3 * i }' > remove_ids
+time_each remove remove_ids "$MANAGER" --remove_treasure churn
+now; start=$NOW
+"$MANAGER" --compact churn > compact.out
+now
+grep -q " compacted: " compact.out || { echo "churn hunt was not compacted" >&2; exit 1; }
+record compact $((3 * OPS)) $((NOW - start))
+
+{
+    printf '{"hunt":{"treasures":%d,"users":%d,"skew":%s,"seed":%d,"ops":%d},\n"benchmarks":[\n' \
+           "$TREASURES" "$USERS" "$SKEW" "$SEED" "$OPS"
+    for ((i = 0; i < ${#RESULTS[@]}; i++)); do
+        [ "$i" -gt 0 ] && printf ',\n'
+        printf '%s' "${RESULTS[$i]}"
+    done
+    printf '\n]}\n'
+} > "$OUT"
+echo "Results written to $OUT" >&2
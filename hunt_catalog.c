@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "treasure.h"
+#include "treasure_reader.h"
+#include "hunt_catalog.h"
+
+#define ROOT_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+#define HUNT_EVENTS (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+static HuntEntry *find_by_name(HuntCatalog *catalog, const char *name)
+{
+    for (int i = 0; i < catalog->count; i++)
+    {
+        if (strcmp(catalog->hunts[i].name, name) == 0)
+        {
+            return &catalog->hunts[i];
+        }
+    }
+    return NULL;
+}
+
+static HuntEntry *find_by_watch(HuntCatalog *catalog, int watch)
+{
+    for (int i = 0; i < catalog->count; i++)
+    {
+        if (catalog->hunts[i].watch == watch)
+        {
+            return &catalog->hunts[i];
+        }
+    }
+    return NULL;
+}
+
+// Start tracking a directory under the root
+static void add_directory(HuntCatalog *catalog, const char *name)
+{
+    if (strlen(name) >= sizeof(catalog->hunts[0].name) || find_by_name(catalog, name) != NULL)
+    {
+        return;
+    }
+
+    if (catalog->count == catalog->capacity)
+    {
+        int capacity = catalog->capacity ? catalog->capacity * 2 : 64;
+        HuntEntry *hunts = realloc(catalog->hunts, capacity * sizeof(HuntEntry));
+        if (hunts == NULL)
+        {
+            return;
+        }
+        catalog->hunts = hunts;
+        catalog->capacity = capacity;
+    }
+
+    HuntEntry *hunt = &catalog->hunts[catalog->count++];
+    memset(hunt, 0, sizeof(*hunt));
+    strcpy(hunt->name, name);
+    hunt->watch = inotify_add_watch(catalog->inotify_fd, name, HUNT_EVENTS);
+    hunt->dirty = 1;
+}
+
+static void remove_directory(HuntCatalog *catalog, const char *name)
+{
+    HuntEntry *hunt = find_by_name(catalog, name);
+    if (hunt == NULL)
+    {
+        return;
+    }
+
+    if (hunt->watch != -1)
+    {
+        inotify_rm_watch(catalog->inotify_fd, hunt->watch);
+    }
+    *hunt = catalog->hunts[--catalog->count];
+}
+
+// Read the root directory and reconcile it with the catalog
+static void scan_root(HuntCatalog *catalog)
+{
+    DIR *dir = opendir(".");
+    if (dir == NULL)
+    {
+        perror("Monitor: Failed to open directory");
+        return;
+    }
+
+    // Entries that are not seen again are dropped
+    for (int i = 0; i < catalog->count; i++)
+    {
+        catalog->hunts[i].dirty = -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        struct stat st;
+        if (entry->d_type != DT_DIR &&
+            (entry->d_type != DT_UNKNOWN || stat(entry->d_name, &st) == -1 || !S_ISDIR(st.st_mode)))
+        {
+            continue;
+        }
+
+        HuntEntry *hunt = find_by_name(catalog, entry->d_name);
+        if (hunt != NULL)
+        {
+            hunt->dirty = 1;
+        }
+        else
+        {
+            add_directory(catalog, entry->d_name);
+        }
+    }
+    closedir(dir);
+
+    for (int i = catalog->count - 1; i >= 0; i--)
+    {
+        if (catalog->hunts[i].dirty == -1)
+        {
+            remove_directory(catalog, catalog->hunts[i].name);
+        }
+    }
+    catalog->needs_rescan = 0;
+}
+
+// Recount one hunt from its treasures file
+static void refresh_hunt(HuntEntry *hunt)
+{
+    char treasure_file[300];
+    sprintf(treasure_file, "%s/treasures", hunt->name);
+
+    hunt->dirty = 0;
+    hunt->is_hunt = 0;
+    hunt->treasure_count = 0;
+    hunt->total_value = 0;
+
+    struct stat st;
+    if (stat(treasure_file, &st) == -1)
+    {
+        return;
+    }
+    hunt->is_hunt = 1;
+    hunt->size = st.st_size;
+    hunt->mtime = st.st_mtime;
+
+    TreasureReader reader;
+    if (openTreasureReader(&reader, treasure_file) == -1)
+    {
+        return;
+    }
+
+    const Treasure *treasure;
+    while ((treasure = nextTreasure(&reader)) != NULL)
+    {
+        if (!TREASURE_IS_DELETED(treasure))
+        {
+            hunt->treasure_count++;
+            hunt->total_value += treasure->value;
+        }
+    }
+    closeTreasureReader(&reader);
+}
+
+int catalog_init(HuntCatalog *catalog)
+{
+    memset(catalog, 0, sizeof(*catalog));
+
+    catalog->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (catalog->inotify_fd == -1)
+    {
+        return -1;
+    }
+
+    catalog->root_watch = inotify_add_watch(catalog->inotify_fd, ".", ROOT_EVENTS);
+    scan_root(catalog);
+    return 0;
+}
+
+void catalog_handle_events(HuntCatalog *catalog)
+{
+    char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+
+    while ((n = read(catalog->inotify_fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (char *p = buffer; p < buffer + n; )
+        {
+            struct inotify_event *event = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                catalog->needs_rescan = 1;
+                continue;
+            }
+
+            if (event->wd == catalog->root_watch)
+            {
+                if (!(event->mask & IN_ISDIR))
+                {
+                    continue;
+                }
+
+                // A hunt directory appeared or disappeared
+                if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                {
+                    add_directory(catalog, event->name);
+                }
+                else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+                {
+                    remove_directory(catalog, event->name);
+                }
+                continue;
+            }
+
+            // Only the treasures file matters inside a hunt, not its index or log
+            HuntEntry *hunt = find_by_watch(catalog, event->wd);
+            if (hunt != NULL && event->len > 0 && strcmp(event->name, "treasures") == 0)
+            {
+                hunt->dirty = 1;
+            }
+        }
+    }
+}
+
+void catalog_refresh(HuntCatalog *catalog)
+{
+    if (catalog->needs_rescan)
+    {
+        scan_root(catalog);
+    }
+
+    for (int i = 0; i < catalog->count; i++)
+    {
+        if (catalog->hunts[i].dirty)
+        {
+            refresh_hunt(&catalog->hunts[i]);
+        }
+    }
+}
+
+void catalog_free(HuntCatalog *catalog)
+{
+    if (catalog->inotify_fd != -1)
+    {
+        close(catalog->inotify_fd);
+    }
+    free(catalog->hunts);
+    memset(catalog, 0, sizeof(*catalog));
+    catalog->inotify_fd = -1;
+}
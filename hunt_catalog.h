@@ -0,0 +1,41 @@
+#ifndef HUNT_CATALOG_H
+#define HUNT_CATALOG_H
+
+#include <time.h>
+
+// What the monitor knows about one directory under the root
+typedef struct {
+    char name[256];
+    int watch;  // inotify watch on the directory
+    int dirty;  // treasures file changed since the last refresh
+    int is_hunt;  // directory has a treasures file
+    int treasure_count;
+    long long total_value;
+    long long size;
+    time_t mtime;
+} HuntEntry;
+
+// In-memory catalog of the hunts under the working directory. inotify
+// events only mark entries dirty; dirty entries are rescanned the next
+// time the catalog is read, so a listing touches only changed hunts.
+typedef struct {
+    int inotify_fd;
+    int root_watch;
+    int needs_rescan;  // events were lost, the root has to be read again
+    HuntEntry *hunts;
+    int count;
+    int capacity;
+} HuntCatalog;
+
+// Scan the working directory once and start watching it
+int catalog_init(HuntCatalog *catalog);
+
+// Consume pending inotify events (call when inotify_fd is readable)
+void catalog_handle_events(HuntCatalog *catalog);
+
+// Bring every dirty entry up to date before the catalog is read
+void catalog_refresh(HuntCatalog *catalog);
+
+void catalog_free(HuntCatalog *catalog);
+
+#endif
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+
+#include "hunt_meta.h"
+#include "treasure.h"
+#include "treasure_reader.h"
+
+//Apply an fcntl lock of the given type over the metadata record
+static int setMetaLock(int fd, short type)
+{
+    struct flock range;
+    memset(&range, 0, sizeof(range));
+    range.l_type = type;
+    range.l_whence = SEEK_SET;
+    range.l_start = 0;
+    range.l_len = sizeof(HuntMeta);
+
+    while (fcntl(fd, F_SETLKW, &range) == -1)
+    {
+        if (errno != EINTR)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int syncHuntDirectory(const char* huntId)
+{
+    char dirPath[100];
+    sprintf(dirPath, "./%s", huntId);
+
+    int dirFd = open(dirPath, O_RDONLY | O_DIRECTORY);
+    if (dirFd == -1)
+    {
+        return -1;
+    }
+    int result = fsync(dirFd);
+    close(dirFd);
+    return result;
+}
+
+//Remove the temp files of treasures file rewrites that never reached
+//their rename. Only lock holders make them, so under the lock every one
+//is a leftover; older versions used the fixed name treasures.tmp.
+static void removeRewriteLeftovers(const char* huntId)
+{
+    char dirPath[100];
+    char path[100];
+    sprintf(dirPath, "./%s", huntId);
+    sprintf(path, "./%s/treasures.tmp", huntId);
+    unlink(path);
+
+    DIR* dir = opendir(dirPath);
+    struct dirent* entry;
+    while (dir != NULL && (entry = readdir(dir)) != NULL)
+    {
+        if (strncmp(entry->d_name, "treasures.tmp.", 14) == 0 &&
+            snprintf(path, sizeof(path), "./%s/%s", huntId, entry->d_name) < (int)sizeof(path))
+        {
+            unlink(path);
+        }
+    }
+    if (dir != NULL)
+    {
+        closedir(dir);
+    }
+}
+
+//Undo whatever a writer that died holding the lock left behind. Appends
+//past the committed size were never acknowledged, so they are cut off;
+//a compaction that did not reach its rename leaves only a temp file.
+//The committed bytes are copied to a new file renamed over the old one
+//instead of truncating it in place: readers do not take the lock and may
+//have the old file mapped, and a mapping cut short raises SIGBUS.
+static void recoverHunt(const char* huntId, HuntLock* lock)
+{
+    char filePath[100];
+    char tempPath[TREASURE_TEMP_PATH_MAX];
+    sprintf(filePath, "./%s/treasures", huntId);
+
+    removeRewriteLeftovers(huntId);
+
+    //Only a file the last commit described can be trimmed; a new inode
+    //means a rename that committed its data before the crash
+    struct stat st;
+    if (stat(filePath, &st) == -1 ||
+        lock->meta.committedInode != (long long)st.st_ino ||
+        st.st_size <= lock->meta.committedSize)
+    {
+        return;
+    }
+
+    int fd = open(filePath, O_RDONLY);
+    int tempFd = fd == -1 ? -1 : createTempFile(filePath, tempPath);
+    int failed = tempFd == -1;
+    unsigned char buffer[16384];
+    off_t offset = 0;
+    while (!failed && offset < lock->meta.committedSize)
+    {
+        size_t want = sizeof(buffer);
+        if (lock->meta.committedSize - offset < (long long)want)
+        {
+            want = lock->meta.committedSize - offset;
+        }
+        ssize_t got = pread(fd, buffer, want, offset);
+        failed = got <= 0 || write(tempFd, buffer, got) != got;
+        offset += got;
+    }
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    //The header may already count the dropped records
+    TreasureFileHeader fileHeader;
+    TreasureReader reader;
+    if (!failed && readTreasureFileHeader(tempFd, &fileHeader) == TREASURE_FORMAT_VERSION &&
+        openTreasureReader(&reader, tempPath) == 0)
+    {
+        fileHeader.recordCount = 0;
+        while (nextTreasure(&reader) != NULL)
+        {
+            fileHeader.recordCount++;
+        }
+        closeTreasureReader(&reader);
+        failed = writeTreasureFileHeader(tempFd, &fileHeader) == -1;
+    }
+    if (tempFd != -1)
+    {
+        failed = fdatasync(tempFd) == -1 || failed;
+        close(tempFd);
+    }
+    if (failed || rename(tempPath, filePath) == -1)
+    {
+        perror("Failed to recover treasure file");
+        if (tempFd != -1)
+        {
+            unlink(tempPath);
+        }
+        return;
+    }
+    syncHuntDirectory(huntId);
+
+    //The commit record follows the file to its new inode, so the next
+    //recovery still recognises it
+    struct stat after;
+    if (stat(filePath, &after) == 0)
+    {
+        lock->meta.committedInode = after.st_ino;
+        if (pwrite(lock->fd, &lock->meta, sizeof(lock->meta), 0) == sizeof(lock->meta))
+        {
+            fdatasync(lock->fd);
+        }
+    }
+
+    printf("Recovered hunt %s: dropped %lld bytes of an unfinished write\n",
+           huntId, (long long)st.st_size - lock->meta.committedSize);
+}
+
+int lockHunt(const char* huntId, HuntLock* lock)
+{
+    char metaPath[100];
+    sprintf(metaPath, "./%s/hunt.meta", huntId);
+
+    lock->fd = open(metaPath, O_RDWR | O_CREAT, 0644);
+    if (lock->fd == -1)
+    {
+        perror("Failed to open hunt metadata");
+        return -1;
+    }
+
+    if (setMetaLock(lock->fd, F_WRLCK) == -1)
+    {
+        perror("Failed to lock hunt");
+        close(lock->fd);
+        lock->fd = -1;
+        return -1;
+    }
+
+    //A new or unreadable file starts from scratch; nextTreasureId reseeds
+    //the counter from the treasures file. Version 1 files keep their
+    //counter and sequence and have no commit record yet.
+    ssize_t got = pread(lock->fd, &lock->meta, sizeof(lock->meta), 0);
+    lock->isNew = got <= 0;
+    int valid = got >= HUNT_META_V1_SIZE && memcmp(lock->meta.magic, HUNT_META_MAGIC, 4) == 0;
+    if (valid && lock->meta.version == 1)
+    {
+        lock->meta.committedSize = 0;
+        lock->meta.committedInode = 0;
+        lock->meta.version = HUNT_META_VERSION;
+    }
+    else if (!valid || got != sizeof(lock->meta) || lock->meta.version != HUNT_META_VERSION)
+    {
+        memset(&lock->meta, 0, sizeof(lock->meta));
+        memcpy(lock->meta.magic, HUNT_META_MAGIC, 4);
+        lock->meta.version = HUNT_META_VERSION;
+        lock->meta.nextId = 1;
+    }
+
+    recoverHunt(huntId, lock);
+
+    return 0;
+}
+
+void seedTreasureIds(HuntLock* lock, int lastId)
+{
+    if (lock->meta.nextId <= lastId)
+    {
+        lock->meta.nextId = lastId + 1;
+    }
+}
+
+int nextTreasureId(HuntLock* lock, int lastId)
+{
+    seedTreasureIds(lock, lastId);
+    return lock->meta.nextId++;
+}
+
+int commitHunt(HuntLock* lock, const char* huntId)
+{
+    char filePath[100];
+    sprintf(filePath, "./%s/treasures", huntId);
+
+    struct stat st;
+    if (stat(filePath, &st) == 0)
+    {
+        lock->meta.committedSize = st.st_size;
+        lock->meta.committedInode = st.st_ino;
+    }
+    lock->meta.sequence++;
+
+    if (pwrite(lock->fd, &lock->meta, sizeof(lock->meta), 0) != sizeof(lock->meta) ||
+        fdatasync(lock->fd) == -1)
+    {
+        perror("Failed to commit hunt metadata");
+        return -1;
+    }
+
+    //The first commit of a hunt also makes its new files reachable
+    if (lock->isNew)
+    {
+        syncHuntDirectory(huntId);
+        lock->isNew = 0;
+    }
+    return 0;
+}
+
+void unlockHunt(HuntLock* lock)
+{
+    //Closing the descriptor drops the fcntl lock
+    if (lock->fd != -1)
+    {
+        close(lock->fd);
+        lock->fd = -1;
+    }
+}
+
+long long readHuntSequence(const char* huntId)
+{
+    char metaPath[100];
+    sprintf(metaPath, "./%s/hunt.meta", huntId);
+
+    int fd = open(metaPath, O_RDONLY);
+    if (fd == -1)
+    {
+        return 0;
+    }
+
+    HuntMeta meta;
+    long long sequence = 0;
+    if (pread(fd, &meta, sizeof(meta), 0) >= HUNT_META_V1_SIZE &&
+        memcmp(meta.magic, HUNT_META_MAGIC, 4) == 0)
+    {
+        sequence = meta.sequence;
+    }
+    close(fd);
+
+    return sequence;
+}
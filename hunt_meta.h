@@ -0,0 +1,63 @@
+#ifndef HUNT_META_H
+#define HUNT_META_H
+
+#define HUNT_META_MAGIC "HMET"
+#define HUNT_META_VERSION 2
+
+//Per-hunt metadata file (<hunt>/hunt.meta). Its first bytes double as the
+//hunt's write lock: every process changing a hunt holds an fcntl write
+//lock on them from before it opens the treasures file until its sidecar
+//files are updated, so appends, tombstones and compactions never
+//interleave.
+//
+//It is also the hunt's commit record. A change is durable once its data
+//is synced and commitHunt has synced the new committed size; taking the
+//lock cuts back any bytes a crashed writer left past that size.
+typedef struct {
+    char magic[4];
+    int version;
+    int nextId;  //next treasure ID to hand out, never goes back
+    int reserved;
+    long long sequence;  //bumped by every change to the hunt
+    long long committedSize;  //treasures file size at the last commit
+    long long committedInode;  //and its inode, 0 while unknown
+} HuntMeta;
+
+//Version 1 files stop after the sequence number
+#define HUNT_META_V1_SIZE 24
+
+typedef struct {
+    int fd;
+    int isNew;  //the metadata file was just created
+    HuntMeta meta;
+} HuntLock;
+
+//Lock a hunt for writing, waiting for other writers, and load its
+//metadata. Leftovers of a crashed writer (an unfinished append, a
+//compaction's temp file) are cleaned up first. The hunt directory must
+//exist. Returns 0 or -1.
+int lockHunt(const char* huntId, HuntLock* lock);
+
+//Make sure the counter is past lastId without taking an ID
+void seedTreasureIds(HuntLock* lock, int lastId);
+
+//Take the next treasure ID. lastId is the highest ID in the treasures
+//file, which seeds the counter for hunts written before it existed.
+int nextTreasureId(HuntLock* lock, int lastId);
+
+//Commit a change whose data is already synced: record the treasures
+//file's size, bump the sequence number and sync the metadata.
+int commitHunt(HuntLock* lock, const char* huntId);
+
+//Release the lock
+void unlockHunt(HuntLock* lock);
+
+//fsync the hunt directory so renames and new files in it are durable
+int syncHuntDirectory(const char* huntId);
+
+//Current sequence number of a hunt (0 if it has no metadata yet). Not
+//for use while this process holds the lock: closing any descriptor of
+//the file drops the process's fcntl locks on it.
+long long readHuntSequence(const char* huntId);
+
+#endif
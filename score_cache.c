@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "score_cache.h"
+
+// Entries read or written at a time. The chunk buffers are per thread, so
+// several hunts can be scored at once.
+#define CACHE_CHUNK 1024
+
+void initScoreCache(ScoreCache *cache) {
+    memset(cache, 0, sizeof(*cache));
+    initScoreTable(&cache->table);
+    initValueStats(&cache->stats);
+}
+
+// Keep room for a first ID per user the table can hold
+static int growFirstIds(ScoreCache *cache) {
+    if (cache->firstIdCapacity >= cache->table.userCapacity) {
+        return 0;
+    }
+    int *firstIds = realloc(cache->firstIds, cache->table.userCapacity * sizeof(int));
+    if (firstIds == NULL) {
+        return -1;
+    }
+    cache->firstIds = firstIds;
+    cache->firstIdCapacity = cache->table.userCapacity;
+    return 0;
+}
+
+int appendScoreCacheUser(ScoreCache *cache, const UserScore *user, int firstId) {
+    int userCount = cache->table.userCount;
+    if (mergeUserScore(&cache->table, user) == -1 || growFirstIds(cache) == -1) {
+        return -1;
+    }
+    // A name already listed would break the listing order
+    if (cache->table.userCount != userCount + 1) {
+        return -1;
+    }
+    cache->firstIds[userCount] = firstId;
+    return 0;
+}
+
+int scoreCacheAdd(ScoreCache *cache, const Treasure *treasure) {
+    int userCount = cache->table.userCount;
+    int user = internUserName(&cache->table, treasure->userName);
+    if (user == -1 || growFirstIds(cache) == -1) {
+        return -1;
+    }
+
+    UserScore *entry = &cache->table.users[user];
+    if (entry->count == 0) {
+        // A listed user whose treasures were all removed would have to move
+        // to the end of the listing
+        if (user < userCount) {
+            return -1;
+        }
+        cache->firstIds[user] = treasure->treasureId;
+    }
+    entry->score += treasure->value;
+    entry->count++;
+
+    ValueStats added = { treasure->value, 1, treasure->value, treasure->value };
+    mergeValueStats(&cache->stats, &added);
+    return 0;
+}
+
+int scoreCacheRemove(ScoreCache *cache, const Treasure *treasure) {
+    UserScore *entry = findUserScore(&cache->table, treasure->userName);
+    if (entry == NULL || entry->count == 0) {
+        return -1;
+    }
+    int user = entry - cache->table.users;
+
+    // The next treasure of the user or the next extreme value is not known
+    // without a scan
+    if (entry->count > 1 && cache->firstIds[user] == treasure->treasureId) {
+        return -1;
+    }
+    if (cache->stats.count > 1 &&
+        (treasure->value == cache->stats.min || treasure->value == cache->stats.max)) {
+        return -1;
+    }
+
+    entry->score -= treasure->value;
+    entry->count--;
+    cache->stats.total -= treasure->value;
+    if (--cache->stats.count == 0) {
+        initValueStats(&cache->stats);
+    }
+    return 0;
+}
+
+static int headerMatches(const ScoreCacheHeader *header, long long sequence, const struct stat *st) {
+    return memcmp(header->magic, SCORE_CACHE_MAGIC, 4) == 0 &&
+           header->version == SCORE_CACHE_VERSION &&
+           header->sequence == sequence &&
+           header->dataSize == st->st_size &&
+           header->dataMtimeSec == st->st_mtim.tv_sec &&
+           header->dataMtimeNsec == st->st_mtim.tv_nsec;
+}
+
+int loadScoreCache(const char *huntId, long long sequence, const struct stat *st, ScoreCache *cache) {
+    char cachePath[100];
+    sprintf(cachePath, "./%s/scores.cache", huntId);
+    initScoreCache(cache);
+
+    int fd = open(cachePath, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    ScoreCacheHeader header;
+    if (read(fd, &header, sizeof(header)) != sizeof(header) || !headerMatches(&header, sequence, st)) {
+        close(fd);
+        return -1;
+    }
+
+    static __thread ScoreCacheEntry entries[CACHE_CHUNK];
+    int loaded = 0;
+    int failed = 0;
+    while (loaded < header.userCount && !failed) {
+        int wanted = header.userCount - loaded < CACHE_CHUNK ? header.userCount - loaded : CACHE_CHUNK;
+        if (read(fd, entries, wanted * sizeof(ScoreCacheEntry)) != (ssize_t)(wanted * sizeof(ScoreCacheEntry))) {
+            failed = 1;
+            break;
+        }
+        for (int i = 0; i < wanted && !failed; i++) {
+            UserScore user;
+            memcpy(user.userName, entries[i].userName, sizeof(user.userName));
+            user.userName[sizeof(user.userName) - 1] = '\0';
+            user.score = entries[i].score;
+            user.count = entries[i].count;
+            failed = appendScoreCacheUser(cache, &user, entries[i].firstId) == -1;
+        }
+        loaded += wanted;
+    }
+    close(fd);
+
+    // A failed load leaves an empty cache to score into
+    if (failed) {
+        freeScoreCache(cache);
+        initScoreCache(cache);
+        return -1;
+    }
+    cache->stats = header.stats;
+    return 0;
+}
+
+int saveScoreCache(const char *huntId, long long sequence, const struct stat *st, ScoreCache *cache) {
+    char cachePath[100];
+    char tempPath[TREASURE_TEMP_PATH_MAX];
+    sprintf(cachePath, "./%s/scores.cache", huntId);
+
+    // score_calculator saves without the hunt lock and the manager with
+    // it, so each save writes its own temp file
+    int fd = createTempFile(cachePath, tempPath);
+    if (fd == -1) {
+        return -1;
+    }
+
+    // Header first with a placeholder count, fixed up once the users are out
+    ScoreCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCORE_CACHE_MAGIC, 4);
+    header.version = SCORE_CACHE_VERSION;
+    header.sequence = sequence;
+    header.dataSize = st->st_size;
+    header.dataMtimeSec = st->st_mtim.tv_sec;
+    header.dataMtimeNsec = st->st_mtim.tv_nsec;
+    header.stats = cache->stats;
+    int failed = write(fd, &header, sizeof(header)) != sizeof(header);
+
+    static __thread ScoreCacheEntry entries[CACHE_CHUNK];
+    int pending = 0;
+    for (int i = 0; i < cache->table.userCount && !failed; i++) {
+        const UserScore *user = &cache->table.users[i];
+        if (user->count == 0) {
+            continue;
+        }
+        memset(&entries[pending], 0, sizeof(ScoreCacheEntry));
+        memcpy(entries[pending].userName, user->userName, sizeof(entries[pending].userName));
+        entries[pending].firstId = cache->firstIds[i];
+        entries[pending].count = user->count;
+        entries[pending].score = user->score;
+        header.userCount++;
+        if (++pending == CACHE_CHUNK) {
+            failed = write(fd, entries, sizeof(entries)) != sizeof(entries);
+            pending = 0;
+        }
+    }
+    if (!failed && pending > 0) {
+        failed = write(fd, entries, pending * sizeof(ScoreCacheEntry)) != (ssize_t)(pending * sizeof(ScoreCacheEntry));
+    }
+    if (!failed) {
+        failed = pwrite(fd, &header, sizeof(header), 0) != sizeof(header);
+    }
+    close(fd);
+
+    // Swap in atomically so readers never see a half-written cache
+    if (failed || rename(tempPath, cachePath) == -1) {
+        unlink(tempPath);
+        return -1;
+    }
+    return 0;
+}
+
+void freeScoreCache(ScoreCache *cache) {
+    freeScoreTable(&cache->table);
+    free(cache->firstIds);
+    cache->firstIds = NULL;
+    cache->firstIdCapacity = 0;
+}
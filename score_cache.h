@@ -0,0 +1,66 @@
+#ifndef SCORE_CACHE_H
+#define SCORE_CACHE_H
+
+#include <sys/stat.h>
+
+#include "treasure.h"
+#include "score_table.h"
+#include "score_kernels.h"
+
+#define SCORE_CACHE_MAGIC "TSCR"
+#define SCORE_CACHE_VERSION 1
+
+// Per-hunt score cache (<hunt>/scores.cache): the finished score table of
+// a hunt, users in listing order (by their first live treasure ID), plus
+// the value totals. It is only trusted for the hunt sequence number and
+// treasures file size/mtime it was stamped with.
+typedef struct {
+    char magic[4];
+    int version;
+    int userCount;
+    int reserved;
+    long long sequence;
+    long long dataSize;
+    long long dataMtimeSec;
+    long long dataMtimeNsec;
+    ValueStats stats;
+} ScoreCacheHeader;
+
+typedef struct {
+    char userName[50];
+    int firstId;  // lowest live treasure ID of the user
+    int count;
+    long long score;
+} ScoreCacheEntry;
+
+typedef struct {
+    ScoreTable table;  // users with a count of 0 are left out when saved
+    int *firstIds;  // parallel to table.users
+    int firstIdCapacity;
+    ValueStats stats;
+} ScoreCache;
+
+void initScoreCache(ScoreCache *cache);
+
+// Load the cache of a hunt if it was stamped with this sequence number and
+// treasures file state. Returns 0, or -1 if it is missing or stale; the
+// cache is left empty then.
+int loadScoreCache(const char *huntId, long long sequence, const struct stat *st, ScoreCache *cache);
+
+// Write the cache stamped with a sequence number and treasures file state
+int saveScoreCache(const char *huntId, long long sequence, const struct stat *st, ScoreCache *cache);
+
+// Add a user's totals at the end of the listing order
+int appendScoreCacheUser(ScoreCache *cache, const UserScore *user, int firstId);
+
+// Follow an appended treasure
+int scoreCacheAdd(ScoreCache *cache, const Treasure *treasure);
+
+// Follow a removed treasure. Returns -1 when the cache cannot be updated
+// in place (the user's first treasure or the hunt's min/max went away)
+// and has to be rebuilt.
+int scoreCacheRemove(ScoreCache *cache, const Treasure *treasure);
+
+void freeScoreCache(ScoreCache *cache);
+
+#endif
@@ -2,111 +2,208 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <dirent.h>
-#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
 
-typedef struct {
-    int treasureId;
-    char userName[50];
-    float latitude;
-    float longitude;
-    char clueText[200];
-    int value;
-} Treasure;
+#include "treasure_columns.h"
+#include "hunt_meta.h"
+#include "score_kernels.h"
+#include "score_hunt.h"
+#include "score_leaderboard.h"
 
-// Function to calculate and print scores for a hunt
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        printf("Usage: %s <hunt_id>\n", argv[0]);
-        return 1;
+static double elapsedSeconds(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+// Time each kernel set over the columns of a hunt and print records/sec
+static int benchKernels(const char *huntId) {
+    TreasureColumns columns;
+    if (openTreasureColumns(&columns, huntId) == -1) {
+        // Writers update the columns in place, so rebuild them under the hunt lock
+        HuntLock lock;
+        int failed = lockHunt(huntId, &lock) == -1;
+        if (!failed) {
+            failed = rebuildTreasureColumns(huntId) == -1;
+            unlockHunt(&lock);
+        }
+        if (failed || openTreasureColumns(&columns, huntId) == -1) {
+            printf("Error: Failed to load the columns of hunt '%s'\n", huntId);
+            return 1;
+        }
     }
     
-    char *huntId = argv[1];
+    int rowCount = columns.header.rowCount;
+    int userCount = columns.header.userCount;
+    long long *scores = calloc(userCount + 1, sizeof(long long));
+    int *counts = calloc(userCount + 1, sizeof(int));
+    int *firstRows = calloc(userCount + 1, sizeof(int));
+    if (scores == NULL || counts == NULL || firstRows == NULL) {
+        printf("Error: Out of memory\n");
+        free(scores);
+        free(counts);
+        free(firstRows);
+        closeTreasureColumns(&columns);
+        return 1;
+    }
     
-    printf("Score calculation for hunt: %s\n", huntId);
+    printf("Kernel benchmark for hunt: %s (%d records, %d users)\n", huntId, rowCount, userCount);
     printf("-----------------------------------\n");
     
-    // Open treasures file
-    char treasureFile[150];
-    sprintf(treasureFile, "%s/treasures", huntId);
-    
-    // Check if file exists
-    struct stat st;
-    if (stat(treasureFile, &st) == -1) {
-        printf("Error: No treasures file found for hunt '%s'\n", huntId);
-        return 1;
+    const ScoreKernels kernelSets[] = { SCORE_KERNELS_SCALAR, SCORE_KERNELS_AVX2 };
+    const char *kernelNames[] = { "scalar", "avx2" };
+    for (int set = 0; set < 2; set++) {
+        if (selectScoreKernels(kernelSets[set]) == -1) {
+            printf("%-7s not supported on this CPU\n", kernelNames[set]);
+            continue;
+        }
+        
+        // Each kernel runs until a quarter second has passed
+        for (int kernel = 0; kernel < 3; kernel++) {
+            struct timespec start;
+            long long records = 0;
+            volatile long long sink = 0;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            do {
+                if (kernel == 0) {
+                    memset(counts, 0, userCount * sizeof(int));
+                    memset(scores, 0, userCount * sizeof(long long));
+                    sumByUser(columns.userIds, columns.values, 0, rowCount, userCount,
+                              scores, counts, firstRows);
+                    records += rowCount;
+                } else if (kernel == 1) {
+                    ValueStats stats;
+                    initValueStats(&stats);
+                    sumValueStats(columns.userIds, columns.values, 0, rowCount, userCount, &stats);
+                    sink += stats.total;
+                    records += rowCount;
+                } else {
+                    sink += argmaxScore(scores, userCount);
+                    records += userCount;
+                }
+            } while (elapsedSeconds(&start) < 0.25 && records > 0);
+            
+            const char *kernelTitles[] = { "sum by user", "value stats", "argmax" };
+            double seconds = elapsedSeconds(&start);
+            printf("%-7s %-12s %14.0f records/sec\n", kernelNames[set], kernelTitles[kernel],
+                   seconds > 0 ? records / seconds : 0);
+        }
     }
     
-    // Open file for reading
-    int fd = open(treasureFile, O_RDONLY);
-    if (fd == -1) {
-        perror("Failed to open treasures file");
+    free(scores);
+    free(counts);
+    free(firstRows);
+    closeTreasureColumns(&columns);
+    return 0;
+}
+
+// Hunt names in byte order, for qsort
+static int compareHuntNames(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Leaderboard over several hunts: all of them, or the ones named
+static int printGlobalLeaderboard(char **names, int count, int all, int threads, const ScoreRanking *ranking,
+                                  OutputFormat format) {
+    char **hunts = names;
+    if (all && (count = findAllHunts(&hunts)) == -1) {
+        perror("Failed to list hunts");
         return 1;
     }
     
-    // Read all treasures and calculate scores by user
-    Treasure treasure;
+    // A hunt named twice still counts once
+    if (!all) {
+        qsort(hunts, count, sizeof(char *), compareHuntNames);
+        int unique = 0;
+        for (int i = 0; i < count; i++) {
+            if (unique == 0 || strcmp(hunts[unique - 1], hunts[i]) != 0) {
+                hunts[unique++] = hunts[i];
+            }
+        }
+        count = unique;
+    }
     
-    // Create an array to store user scores
-    #define MAX_USERS 50
-    char userNames[MAX_USERS][50];
-    int userScores[MAX_USERS];
-    int userCount = 0;
+    Leaderboard board;
+    int failed = scoreHunts(hunts, count, threads, &board) == -1;
+    if (failed) {
+        fprintf(stderr, "Error: Out of memory while merging scores\n");
+    } else {
+        failed = printLeaderboard(stdout, &board, ranking, format) != 0 || board.failedCount > 0;
+    }
+    freeLeaderboard(&board);
     
-    // Read all treasures and update scores
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure)) {
-        // Check if user already exists in our array
-        int userIndex = -1;
-        for (int i = 0; i < userCount; i++) {
-            if (strcmp(userNames[i], treasure.userName) == 0) {
-                userIndex = i;
-                break;
-            }
+    if (all) {
+        for (int i = 0; i < count; i++) {
+            free(hunts[i]);
         }
-        
-        if (userIndex == -1) {
-            // New user
-            if (userCount < MAX_USERS) {
-                strcpy(userNames[userCount], treasure.userName);
-                userScores[userCount] = treasure.value;
-                userCount++;
-            }
+        free(hunts);
+    }
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    static const char usage[] =
+        "Usage: %s [-j threads] [-b] [--top K | --rank] [--rank-style=competition|dense]\n"
+        "          [--format=text|json|ndjson|binary] <hunt_id>\n"
+        "       %s [-j threads] [--top K | --rank] [--rank-style=...] [--format=...]\n"
+        "          --all | <hunt_id> <hunt_id>...\n";
+    static const struct option longOptions[] = {
+        {"format", required_argument, NULL, 'f'},
+        {"all", no_argument, NULL, 'a'},
+        {"top", required_argument, NULL, 'k'},
+        {"rank", no_argument, NULL, 'r'},
+        {"rank-style", required_argument, NULL, 's'},
+        {NULL, 0, NULL, 0}
+    };
+    int jobs = 0;
+    int bench = 0;
+    int all = 0;
+    int top = -1;  // -1 until --top or --rank is given
+    RankStyle style = RANK_COMPETITION;
+    OutputFormat format = OUTPUT_TEXT;
+    int opt;
+    
+    while ((opt = getopt_long(argc, argv, "j:b", longOptions, NULL)) != -1) {
+        if (opt == 'j' && atoi(optarg) > 0) {
+            jobs = atoi(optarg);
+        } else if (opt == 'b') {
+            bench = 1;
+        } else if (opt == 'f' && parseOutputFormat(optarg, &format) == 0) {
+            continue;
+        } else if (opt == 'a') {
+            all = 1;
+        } else if (opt == 'k' && atoi(optarg) >= 0) {
+            top = atoi(optarg);
+        } else if (opt == 'r') {
+            top = 0;
+        } else if (opt == 's' && parseRankStyle(optarg, &style) == 0) {
+            continue;
         } else {
-            // Existing user, update score
-            userScores[userIndex] += treasure.value;
+            printf(usage, argv[0], argv[0]);
+            return 1;
         }
     }
     
-    close(fd);
-    
-    // Print results
-    if (userCount == 0) {
-        printf("No treasures found in this hunt.\n");
-        return 0;
+    int huntCount = argc - optind;
+    if ((all ? huntCount != 0 : huntCount < 1) || (bench && (all || huntCount != 1))) {
+        printf(usage, argv[0], argv[0]);
+        return 1;
     }
     
-    printf("User Scores:\n");
-    printf("------------\n");
-    
-    for (int i = 0; i < userCount; i++) {
-        printf("User: %-15s Score: %d\n", userNames[i], userScores[i]);
+    // Several hunts are scored one per thread, a single hunt with -j threads
+    if (all || huntCount > 1) {
+        int threads = jobs > 0 ? jobs : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        ScoreRanking ranking = {top == -1 ? 10 : top, style};
+        return printGlobalLeaderboard(argv + optind, huntCount, all, threads, &ranking, format);
     }
     
-    // Find the winner
-    int maxScore = -1;
-    int winnerIndex = -1;
-    
-    for (int i = 0; i < userCount; i++) {
-        if (userScores[i] > maxScore) {
-            maxScore = userScores[i];
-            winnerIndex = i;
-        }
+    char *huntId = argv[optind];
+    if (bench) {
+        return benchKernels(huntId);
     }
     
-    printf("\nWinner: %s with score %d\n", userNames[winnerIndex], maxScore);
-    printf("-----------------------------------\n");
-    
-    return 0;
-}
\ No newline at end of file
+    // A single hunt keeps its first-seen order unless a ranking is asked for
+    ScoreRanking ranking = {top, style};
+    return printHuntScores(stdout, huntId, jobs > 0 ? jobs : 1, top == -1 ? NULL : &ranking, format);
+}
@@ -0,0 +1,575 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <limits.h>
+
+#include "treasure.h"
+#include "treasure_reader.h"
+#include "treasure_index.h"
+#include "treasure_columns.h"
+#include "score_table.h"
+#include "score_kernels.h"
+#include "score_cache.h"
+#include "score_hunt.h"
+#include "score_rank.h"
+#include "treasure_output.h"
+#include "hunt_meta.h"
+
+// Work description for one scoring thread
+typedef struct {
+    const char *treasureFile;
+    off_t start;
+    off_t end;
+    ScoreTable table;
+    ValueStats stats;
+    int failed;
+} ScoreJob;
+
+// Work description for one thread scoring a range of column rows
+typedef struct {
+    const TreasureColumns *columns;
+    int startRow;
+    int endRow;
+    long long *scores;
+    int *counts;
+    int *firstRows;
+    ValueStats stats;
+} ColumnJob;
+
+// Add every live treasure starting in [start, end) to the job's table
+static void *scoreRange(void *arg) {
+    ScoreJob *job = arg;
+    initScoreTable(&job->table);
+    initValueStats(&job->stats);
+    job->failed = 0;
+    
+    TreasureReader reader;
+    if (openTreasureReader(&reader, job->treasureFile) == -1) {
+        job->failed = 1;
+        return NULL;
+    }
+    limitTreasureReader(&reader, job->start, job->end);
+    
+    const Treasure *treasure;
+    while ((treasure = nextTreasure(&reader)) != NULL) {
+        // Removed treasures do not count towards any score
+        if (TREASURE_IS_DELETED(treasure)) {
+            continue;
+        }
+        
+        if (addScore(&job->table, treasure->userName, treasure->value) == -1) {
+            job->failed = 1;
+            break;
+        }
+        
+        ValueStats *stats = &job->stats;
+        stats->total += treasure->value;
+        stats->count++;
+        if (treasure->value < stats->min) {
+            stats->min = treasure->value;
+        }
+        if (treasure->value > stats->max) {
+            stats->max = treasure->value;
+        }
+    }
+    
+    closeTreasureReader(&reader);
+    return NULL;
+}
+
+// Score a hunt by walking its records, split across jobs threads.
+// Returns 0 on success, -1 on error.
+static int scoreFromRecords(const char *huntId, const char *treasureFile, int jobs,
+                            ScoreTable *table, ValueStats *stats) {
+    // Records vary in length, so the ID index supplies record-aligned
+    // split points; the file is cut into one range per thread
+    int recordCount = 0;
+    if (jobs > 1) {
+        TreasureIndexHeader header;
+        int lastId;
+        if (getTreasureIndexInfo(huntId, &header, &lastId) == 0) {
+            recordCount = header.entryCount;
+        }
+        if (jobs > recordCount) {
+            jobs = recordCount > 0 ? recordCount : 1;
+        }
+    }
+    
+    ScoreJob *scoreJobs = calloc(jobs, sizeof(ScoreJob));
+    pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+    if (scoreJobs == NULL || threads == NULL) {
+        free(scoreJobs);
+        free(threads);
+        return -1;
+    }
+    
+    for (int i = 0; i < jobs; i++) {
+        int position = (long long)recordCount * i / jobs;
+        scoreJobs[i].treasureFile = treasureFile;
+        scoreJobs[i].start = 0;
+        if (i > 0 && getTreasureOffsetAt(huntId, position, &scoreJobs[i].start) == -1) {
+            free(scoreJobs);
+            free(threads);
+            return -1;
+        }
+        if (i > 0) {
+            scoreJobs[i - 1].end = scoreJobs[i].start;
+        }
+    }
+    
+    // The last range also takes any records appended since the split
+    scoreJobs[jobs - 1].end = (off_t)LLONG_MAX;
+    
+    if (jobs == 1) {
+        scoreRange(&scoreJobs[0]);
+    } else {
+        for (int i = 0; i < jobs; i++) {
+            if (pthread_create(&threads[i], NULL, scoreRange, &scoreJobs[i]) != 0) {
+                perror("Failed to start scoring thread");
+                exit(1);
+            }
+        }
+        for (int i = 0; i < jobs; i++) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    
+    // Merging the ranges in file order keeps users in first-seen order,
+    // so the listing and the winner tie-break match a sequential scan
+    *table = scoreJobs[0].table;
+    *stats = scoreJobs[0].stats;
+    int failed = scoreJobs[0].failed;
+    for (int i = 1; i < jobs; i++) {
+        mergeValueStats(stats, &scoreJobs[i].stats);
+        for (int u = 0; u < scoreJobs[i].table.userCount && !failed; u++) {
+            if (mergeUserScore(table, &scoreJobs[i].table.users[u]) == -1) {
+                failed = 1;
+            }
+        }
+        failed |= scoreJobs[i].failed;
+        freeScoreTable(&scoreJobs[i].table);
+    }
+    free(scoreJobs);
+    free(threads);
+    
+    return failed ? -1 : 0;
+}
+
+// Per-user totals over the column rows in [startRow, endRow)
+static void *scoreColumnRange(void *arg) {
+    ColumnJob *job = arg;
+    const TreasureColumns *columns = job->columns;
+    
+    // Removed treasures carry a code past the dictionary and are skipped
+    sumByUser(columns->userIds, columns->values, job->startRow, job->endRow,
+              columns->header.userCount, job->scores, job->counts, job->firstRows);
+    initValueStats(&job->stats);
+    sumValueStats(columns->userIds, columns->values, job->startRow, job->endRow,
+                  columns->header.userCount, &job->stats);
+    return NULL;
+}
+
+static int compareFirstRow(const void *a, const void *b) {
+    const int *left = a;
+    const int *right = b;
+    return (left[0] > right[0]) - (left[0] < right[0]);
+}
+
+// Score a hunt from its column files: the dictionary codes index plain
+// arrays, so no names are hashed per record. The cache gets each user's
+// first row in place of the first ID. Returns 0 on success, -1 on error.
+static int scoreFromColumns(const TreasureColumns *columns, int jobs, ScoreCache *cache) {
+    int rowCount = columns->header.rowCount;
+    int userCount = columns->header.userCount;
+    if (jobs > rowCount) {
+        jobs = rowCount > 0 ? rowCount : 1;
+    }
+    
+    ColumnJob *columnJobs = calloc(jobs, sizeof(ColumnJob));
+    pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+    int failed = columnJobs == NULL || threads == NULL;
+    
+    for (int i = 0; i < jobs && !failed; i++) {
+        columnJobs[i].columns = columns;
+        columnJobs[i].startRow = (long long)rowCount * i / jobs;
+        columnJobs[i].endRow = (long long)rowCount * (i + 1) / jobs;
+        columnJobs[i].scores = calloc(userCount + 1, sizeof(long long));
+        columnJobs[i].counts = calloc(userCount + 1, sizeof(int));
+        columnJobs[i].firstRows = calloc(userCount + 1, sizeof(int));
+        failed = columnJobs[i].scores == NULL || columnJobs[i].counts == NULL ||
+                 columnJobs[i].firstRows == NULL;
+    }
+    
+    if (!failed && jobs == 1) {
+        scoreColumnRange(&columnJobs[0]);
+    } else if (!failed) {
+        for (int i = 0; i < jobs; i++) {
+            if (pthread_create(&threads[i], NULL, scoreColumnRange, &columnJobs[i]) != 0) {
+                perror("Failed to start scoring thread");
+                exit(1);
+            }
+        }
+        for (int i = 0; i < jobs; i++) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    
+    // Fold later ranges into the first; the earliest range to see a user
+    // holds its first row, since ranges are in file order
+    ColumnJob *total = &columnJobs[0];
+    for (int i = 0; i < jobs && !failed; i++) {
+        mergeValueStats(&cache->stats, &columnJobs[i].stats);
+    }
+    for (int i = 1; i < jobs && !failed; i++) {
+        for (int user = 0; user < userCount; user++) {
+            if (columnJobs[i].counts[user] > 0 && total->counts[user] == 0) {
+                total->firstRows[user] = columnJobs[i].firstRows[user];
+            }
+            total->counts[user] += columnJobs[i].counts[user];
+            total->scores[user] += columnJobs[i].scores[user];
+        }
+    }
+    
+    // List users by their first live row, as a sequential scan would
+    int (*order)[2] = failed ? NULL : malloc((userCount + 1) * sizeof(*order));
+    int listed = 0;
+    failed |= order == NULL;
+    for (int user = 0; user < userCount && !failed; user++) {
+        if (total->counts[user] > 0) {
+            order[listed][0] = total->firstRows[user];
+            order[listed][1] = user;
+            listed++;
+        }
+    }
+    if (!failed) {
+        qsort(order, listed, sizeof(*order), compareFirstRow);
+    }
+    
+    for (int i = 0; i < listed && !failed; i++) {
+        int user = order[i][1];
+        UserScore entry;
+        memcpy(entry.userName, columns->userNames[user], sizeof(entry.userName));
+        entry.userName[sizeof(entry.userName) - 1] = '\0';
+        entry.score = total->scores[user];
+        entry.count = total->counts[user];
+        failed = appendScoreCacheUser(cache, &entry, order[i][0]) == -1;
+    }
+    
+    free(order);
+    for (int i = 0; columnJobs != NULL && i < jobs; i++) {
+        free(columnJobs[i].scores);
+        free(columnJobs[i].counts);
+        free(columnJobs[i].firstRows);
+    }
+    free(columnJobs);
+    free(threads);
+    
+    return failed ? -1 : 0;
+}
+
+static int sameFileState(const struct stat *a, const struct stat *b) {
+    return a->st_size == b->st_size && a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+           a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+// Score from the column files and keep the result as the hunt's score
+// cache, provided no writer committed while the columns were read
+static int scoreAndCache(const char *huntId, const char *treasureFile, int jobs,
+                         long long sequence, const struct stat *st, ScoreCache *cache) {
+    TreasureColumns columns;
+    if (openTreasureColumns(&columns, huntId) == -1) {
+        return -1;
+    }
+    
+    int failed = scoreFromColumns(&columns, jobs, cache) == -1;
+    struct stat columnState;
+    columnState.st_size = columns.header.dataSize;
+    columnState.st_mtim.tv_sec = columns.header.dataMtimeSec;
+    columnState.st_mtim.tv_nsec = columns.header.dataMtimeNsec;
+    closeTreasureColumns(&columns);
+    if (failed) {
+        return 1;
+    }
+    
+    // Rows become IDs through the index; a cache is only written for the
+    // exact file state the columns were built from
+    struct stat after;
+    if (sameFileState(&columnState, st) &&
+        getTreasureIdsAt(huntId, cache->firstIds, cache->table.userCount, cache->firstIds) == 0 &&
+        stat(treasureFile, &after) == 0 && sameFileState(&after, st) &&
+        readHuntSequence(huntId) == sequence) {
+        saveScoreCache(huntId, sequence, st, cache);
+    }
+    return 0;
+}
+
+int scoreHunt(const char *huntId, int jobs, ScoreCache *cache) {
+    char treasureFile[150];
+    sprintf(treasureFile, "%s/treasures", huntId);
+    
+    struct stat st;
+    if (stat(treasureFile, &st) == -1) {
+        initScoreCache(cache);
+        return -1;
+    }
+    
+    // A score cache stamped with the current sequence number and file
+    // state answers in O(users). Otherwise the columns are used while they
+    // match the treasures file (and refresh the cache); hunts without them
+    // (or changed behind their back) are scanned record by record.
+    long long sequence = readHuntSequence(huntId);
+    if (loadScoreCache(huntId, sequence, &st, cache) == 0) {
+        return 0;
+    }
+    int scored = scoreAndCache(huntId, treasureFile, jobs, sequence, &st, cache);
+    if (scored == -1) {
+        return scoreFromRecords(huntId, treasureFile, jobs, &cache->table, &cache->stats) == -1 ? -2 : 0;
+    }
+    return scored != 0 ? -2 : 0;
+}
+
+// Index of the winning user: the first one with the highest score.
+// Scanned over a contiguous copy of the scores. -1 when out of memory.
+static int findWinner(const ScoreTable *table) {
+    long long *scores = malloc(table->userCount * sizeof(long long));
+    if (scores == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < table->userCount; i++) {
+        scores[i] = table->users[i].score;
+    }
+    int winnerIndex = argmaxScore(scores, table->userCount);
+    free(scores);
+    return winnerIndex;
+}
+
+size_t formatUserScoreJson(const char *huntId, long rank, const UserScore *user, char *out) {
+    char *end = out;
+    *end++ = '{';
+    if (huntId != NULL) {
+        memcpy(end, "\"hunt\":", 7);
+        end = appendJsonString(end + 7, huntId);
+        *end++ = ',';
+    }
+    if (rank > 0) {
+        memcpy(end, "\"rank\":", 7);
+        end = appendJsonInt(end + 7, rank);
+        *end++ = ',';
+    }
+    memcpy(end, "\"user\":", 7);
+    end = appendJsonString(end + 7, user->userName);
+    memcpy(end, ",\"score\":", 9);
+    end = appendJsonInt(end + 9, user->score);
+    memcpy(end, ",\"treasures\":", 13);
+    end = appendJsonInt(end + 13, user->count);
+    *end++ = '}';
+    return end - out;
+}
+
+// Users of a report in the order they are printed: first-seen order, or
+// rank order (with rank numbers) when a ranking was asked for
+typedef struct {
+    int *order;
+    long *ranks;  // NULL when unranked
+    int count;
+    int winnerIndex;  // -1 without users
+    int tiedWinners;  // other users with the winning score, when ranked
+} ReportOrder;
+
+static int orderReport(const ScoreTable *table, const ScoreRanking *ranking, ReportOrder *report) {
+    memset(report, 0, sizeof(*report));
+    report->winnerIndex = -1;
+    report->count = ranking != NULL ? rankedCount(table, ranking) : table->userCount;
+    report->order = malloc((report->count > 0 ? report->count : 1) * sizeof(int));
+    if (ranking != NULL) {
+        report->ranks = malloc((report->count > 0 ? report->count : 1) * sizeof(long));
+    }
+    if (report->order == NULL || (ranking != NULL && report->ranks == NULL)) {
+        return -1;
+    }
+
+    if (ranking == NULL) {
+        for (int i = 0; i < report->count; i++) {
+            report->order[i] = i;
+        }
+        report->winnerIndex = table->userCount > 0 ? findWinner(table) : -1;
+        return table->userCount > 0 && report->winnerIndex == -1 ? -1 : 0;
+    }
+
+    report->count = rankUsers(table, ranking, report->order);
+    numberRanks(table, report->order, report->count, ranking->style, report->ranks);
+    if (report->count > 0) {
+        // Ties for first place are counted over every user, shown or not
+        report->winnerIndex = report->order[0];
+        for (int i = 0; i < table->userCount; i++) {
+            if (i != report->winnerIndex && table->users[i].score == table->users[report->winnerIndex].score) {
+                report->tiedWinners++;
+            }
+        }
+    }
+    return 0;
+}
+
+static void freeReportOrder(ReportOrder *report) {
+    free(report->order);
+    free(report->ranks);
+}
+
+// Scores in one of the machine-readable formats
+static void printScoresAs(FILE *out, const char *huntId, const ScoreCache *cache,
+                          const ReportOrder *report, OutputFormat format) {
+    const ScoreTable *table = &cache->table;
+    const ValueStats *stats = &cache->stats;
+    char json[USER_SCORE_JSON_MAX + 128];
+
+    if (format == OUTPUT_BINARY) {
+        for (int i = 0; i < report->count; i++) {
+            const UserScore *user = &table->users[report->order[i]];
+            ScoreRecord record;
+            memset(&record, 0, sizeof(record));
+            memcpy(record.userName, user->userName, sizeof(record.userName));
+            record.count = user->count;
+            record.score = user->score;
+            fwrite(&record, sizeof(record), 1, out);
+        }
+        return;
+    }
+
+    if (format == OUTPUT_NDJSON) {
+        for (int i = 0; i < report->count; i++) {
+            size_t length = formatUserScoreJson(huntId, report->ranks != NULL ? report->ranks[i] : 0,
+                                                &table->users[report->order[i]], json);
+            json[length++] = '\n';
+            fwrite(json, 1, length, out);
+        }
+        return;
+    }
+
+    char *end = json;
+    memcpy(end, "{\"hunt\":", 8);
+    end = appendJsonString(end + 8, huntId);
+    memcpy(end, ",\"users\":[", 10);
+    fwrite(json, 1, end + 10 - json, out);
+
+    for (int i = 0; i < report->count; i++) {
+        size_t length = 0;
+        if (i > 0) {
+            json[length++] = ',';
+        }
+        json[length++] = '\n';
+        length += formatUserScoreJson(NULL, report->ranks != NULL ? report->ranks[i] : 0,
+                                      &table->users[report->order[i]], json + length);
+        fwrite(json, 1, length, out);
+    }
+
+    end = json;
+    memcpy(end, "],\"winner\":", 11);
+    end += 11;
+    if (report->winnerIndex == -1) {
+        memcpy(end, "null", 4);
+        end += 4;
+    } else {
+        end += formatUserScoreJson(NULL, 0, &table->users[report->winnerIndex], end);
+    }
+    memcpy(end, ",\"treasures\":", 13);
+    end = appendJsonInt(end + 13, stats->count);
+    memcpy(end, ",\"total_value\":", 15);
+    end = appendJsonInt(end + 15, stats->total);
+    if (stats->count > 0) {
+        memcpy(end, ",\"min\":", 7);
+        end = appendJsonInt(end + 7, stats->min);
+        memcpy(end, ",\"max\":", 7);
+        end = appendJsonInt(end + 7, stats->max);
+        memcpy(end, ",\"average\":", 11);
+        end = appendJsonFixed(end + 11, (double)stats->total / stats->count, 2);
+    }
+    memcpy(end, "}\n", 2);
+    fwrite(json, 1, end + 2 - json, out);
+}
+
+int printHuntScores(FILE *out, const char *huntId, int jobs, const ScoreRanking *ranking, OutputFormat format) {
+    // Machine-readable output keeps out for the data alone
+    FILE *messages = format == OUTPUT_TEXT ? out : stderr;
+    if (format == OUTPUT_TEXT) {
+        fprintf(out, "Score calculation for hunt: %s\n", huntId);
+        fprintf(out, "-----------------------------------\n");
+    }
+    
+    ScoreCache cache;
+    int scored = scoreHunt(huntId, jobs, &cache);
+    ScoreTable table = cache.table;
+    ValueStats stats = cache.stats;
+    
+    if (scored == -1) {
+        fprintf(messages, "Error: No treasures file found for hunt '%s'\n", huntId);
+        freeScoreCache(&cache);
+        return 1;
+    }
+    if (scored != 0) {
+        fprintf(messages, "Error: Failed to score hunt '%s'\n", huntId);
+        freeScoreCache(&cache);
+        return 1;
+    }
+    
+    ReportOrder report;
+    if (orderReport(&table, ranking, &report) == -1) {
+        fprintf(messages, "Error: Out of memory while scoring hunt '%s'\n", huntId);
+        freeReportOrder(&report);
+        freeScoreCache(&cache);
+        return 1;
+    }
+    
+    if (format != OUTPUT_TEXT) {
+        printScoresAs(out, huntId, &cache, &report, format);
+        freeReportOrder(&report);
+        freeScoreCache(&cache);
+        return 0;
+    }
+    
+    // Print results
+    if (table.userCount == 0) {
+        fprintf(out, "No treasures found in this hunt.\n");
+        freeReportOrder(&report);
+        freeScoreCache(&cache);
+        return 0;
+    }
+    
+    if (ranking == NULL) {
+        fprintf(out, "User Scores:\n");
+        fprintf(out, "------------\n");
+        for (int i = 0; i < table.userCount; i++) {
+            fprintf(out, "User: %-15s Score: %lld\n", table.users[i].userName, table.users[i].score);
+        }
+    } else {
+        if (report.count < table.userCount) {
+            fprintf(out, "User Scores, top %d of %d:\n", report.count, table.userCount);
+        } else {
+            fprintf(out, "User Scores, ranked:\n");
+        }
+        fprintf(out, "------------\n");
+        for (int i = 0; i < report.count; i++) {
+            const UserScore *user = &table.users[report.order[i]];
+            fprintf(out, "%4ld. %-15s Score: %lld  Treasures: %d\n", report.ranks[i], user->userName,
+                    user->score, user->count);
+        }
+    }
+    
+    const UserScore *winner = &table.users[report.winnerIndex];
+    if (report.tiedWinners > 0) {
+        fprintf(out, "\nWinner: %s with score %lld (tied with %d more)\n", winner->userName, winner->score,
+                report.tiedWinners);
+    } else {
+        fprintf(out, "\nWinner: %s with score %lld\n", winner->userName, winner->score);
+    }
+    fprintf(out, "Treasures: %lld  Total value: %lld  Min: %d  Max: %d  Average: %.2f\n",
+            stats.count, stats.total, stats.min, stats.max, (double)stats.total / stats.count);
+    fprintf(out, "-----------------------------------\n");
+    
+    freeReportOrder(&report);
+    freeScoreCache(&cache);
+    return 0;
+}
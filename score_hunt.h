@@ -0,0 +1,40 @@
+#ifndef SCORE_HUNT_H
+#define SCORE_HUNT_H
+
+#include <stdio.h>
+
+#include "score_cache.h"
+#include "treasure_output.h"
+#include "score_rank.h"
+
+// One user of a binary score report, host order
+typedef struct {
+    char userName[50];
+    int count;
+    long long score;
+} ScoreRecord;
+
+// Score one hunt: from its score cache when that is fresh, else from its
+// column files (refreshing the cache), else by scanning the records with
+// jobs threads. Returns 0, -1 if the hunt has no treasures file or -2 if
+// scoring failed. The cache holds the result and is freed by the caller
+// in every case.
+int scoreHunt(const char *huntId, int jobs, ScoreCache *cache);
+
+// Longest object formatUserScoreJson() can produce, with a hunt name of at
+// most 255 bytes
+#define USER_SCORE_JSON_MAX (96 + 6 * (255 + 49))
+
+// One user's totals as a JSON object, tagged with the hunt when huntId is
+// given and with the rank when it is above 0. Returns its length.
+size_t formatUserScoreJson(const char *huntId, long rank, const UserScore *user, char *out);
+
+// Print the score report of a hunt (per-user scores, winner and value
+// totals) to out. Users come in first-seen order, or in rank order with
+// rank numbers when a ranking is given (the top ones only, if it says so).
+// JSON gives one object per hunt, NDJSON one line per user and binary one
+// ScoreRecord per user; in those formats errors go to stderr.
+// Returns 0, or 1 if the hunt could not be scored.
+int printHuntScores(FILE *out, const char *huntId, int jobs, const ScoreRanking *ranking, OutputFormat format);
+
+#endif
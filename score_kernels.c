@@ -0,0 +1,257 @@
+#include <limits.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "score_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNELS 1
+#endif
+
+typedef void (*SumByUserKernel)(const uint32_t *, const int32_t *, int, int,
+                                uint32_t, long long *, int *, int *);
+typedef void (*ValueStatsKernel)(const uint32_t *, const int32_t *, int, int,
+                                 uint32_t, ValueStats *);
+typedef int (*ArgmaxKernel)(const long long *, int);
+
+static struct {
+    int chosen;
+    ScoreKernels kernels;
+    SumByUserKernel sumByUser;
+    ValueStatsKernel sumValueStats;
+    ArgmaxKernel argmax;
+} active;
+
+void initValueStats(ValueStats *stats) {
+    stats->total = 0;
+    stats->count = 0;
+    stats->min = INT_MAX;
+    stats->max = INT_MIN;
+}
+
+void mergeValueStats(ValueStats *stats, const ValueStats *other) {
+    stats->total += other->total;
+    stats->count += other->count;
+    if (other->min < stats->min) {
+        stats->min = other->min;
+    }
+    if (other->max > stats->max) {
+        stats->max = other->max;
+    }
+}
+
+// Scalar kernels
+
+static void sumByUserScalar(const uint32_t *userIds, const int32_t *values, int start, int end,
+                            uint32_t userCount, long long *scores, int *counts, int *firstRows) {
+    for (int row = start; row < end; row++) {
+        uint32_t user = userIds[row];
+        if (user >= userCount) {
+            continue;
+        }
+        if (counts[user]++ == 0) {
+            firstRows[user] = row;
+        }
+        scores[user] += values[row];
+    }
+}
+
+static void sumValueStatsScalar(const uint32_t *userIds, const int32_t *values, int start, int end,
+                                uint32_t userCount, ValueStats *stats) {
+    for (int row = start; row < end; row++) {
+        if (userIds[row] >= userCount) {
+            continue;
+        }
+        int value = values[row];
+        stats->total += value;
+        stats->count++;
+        if (value < stats->min) {
+            stats->min = value;
+        }
+        if (value > stats->max) {
+            stats->max = value;
+        }
+    }
+}
+
+static int argmaxScalar(const long long *scores, int count) {
+    int best = count > 0 ? 0 : -1;
+    for (int i = 1; i < count; i++) {
+        if (scores[i] > scores[best]) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+#ifdef HAVE_AVX2_KERNELS
+
+// Lanes holding a live row: 0 <= code < userCount as signed 32-bit values,
+// which also rejects the removed marker (all bits set)
+__attribute__((target("avx2")))
+static inline __m256i liveMask(const uint32_t *userIds, __m256i limit) {
+    __m256i codes = _mm256_loadu_si256((const __m256i *)userIds);
+    __m256i belowLimit = _mm256_cmpgt_epi32(limit, codes);
+    __m256i notNegative = _mm256_cmpgt_epi32(codes, _mm256_set1_epi32(-1));
+    return _mm256_and_si256(belowLimit, notNegative);
+}
+
+__attribute__((target("avx2")))
+static void sumValueStatsAvx2(const uint32_t *userIds, const int32_t *values, int start, int end,
+                              uint32_t userCount, ValueStats *stats) {
+    if (userCount > INT_MAX) {
+        sumValueStatsScalar(userIds, values, start, end, userCount, stats);
+        return;
+    }
+
+    __m256i limit = _mm256_set1_epi32((int)userCount);
+    __m256i minimum = _mm256_set1_epi32(INT_MAX);
+    __m256i maximum = _mm256_set1_epi32(INT_MIN);
+    __m256i total = _mm256_setzero_si256();
+    __m256i count = _mm256_setzero_si256();
+    int row = start;
+
+    for (; row + 8 <= end; row += 8) {
+        __m256i live = liveMask(userIds + row, limit);
+        __m256i value = _mm256_loadu_si256((const __m256i *)(values + row));
+        __m256i kept = _mm256_and_si256(value, live);
+
+        minimum = _mm256_min_epi32(minimum, _mm256_blendv_epi8(_mm256_set1_epi32(INT_MAX), value, live));
+        maximum = _mm256_max_epi32(maximum, _mm256_blendv_epi8(_mm256_set1_epi32(INT_MIN), value, live));
+        // Widen to 64 bits before adding so large hunts cannot overflow a lane
+        total = _mm256_add_epi64(total, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(kept)));
+        total = _mm256_add_epi64(total, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(kept, 1)));
+        count = _mm256_sub_epi64(count, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(live)));
+        count = _mm256_sub_epi64(count, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(live, 1)));
+    }
+
+    int lanes32[8];
+    long long lanes64[4];
+    _mm256_storeu_si256((__m256i *)lanes32, minimum);
+    for (int i = 0; i < 8; i++) {
+        if (lanes32[i] < stats->min) {
+            stats->min = lanes32[i];
+        }
+    }
+    _mm256_storeu_si256((__m256i *)lanes32, maximum);
+    for (int i = 0; i < 8; i++) {
+        if (lanes32[i] > stats->max) {
+            stats->max = lanes32[i];
+        }
+    }
+    _mm256_storeu_si256((__m256i *)lanes64, total);
+    stats->total += lanes64[0] + lanes64[1] + lanes64[2] + lanes64[3];
+    _mm256_storeu_si256((__m256i *)lanes64, count);
+    stats->count += lanes64[0] + lanes64[1] + lanes64[2] + lanes64[3];
+
+    sumValueStatsScalar(userIds, values, row, end, userCount, stats);
+}
+
+// Two passes: the maximum four lanes at a time, then the first index
+// holding it, which keeps the scalar tie-break (earliest user wins)
+__attribute__((target("avx2")))
+static int argmaxAvx2(const long long *scores, int count) {
+    if (count < 8) {
+        return argmaxScalar(scores, count);
+    }
+
+    __m256i maximum = _mm256_loadu_si256((const __m256i *)scores);
+    int i = 4;
+    for (; i + 4 <= count; i += 4) {
+        __m256i value = _mm256_loadu_si256((const __m256i *)(scores + i));
+        maximum = _mm256_blendv_epi8(maximum, value, _mm256_cmpgt_epi64(value, maximum));
+    }
+
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, maximum);
+    long long best = lanes[0];
+    for (int lane = 1; lane < 4; lane++) {
+        if (lanes[lane] > best) {
+            best = lanes[lane];
+        }
+    }
+    for (; i < count; i++) {
+        if (scores[i] > best) {
+            best = scores[i];
+        }
+    }
+
+    __m256i target = _mm256_set1_epi64x(best);
+    for (i = 0; i + 4 <= count; i += 4) {
+        __m256i value = _mm256_loadu_si256((const __m256i *)(scores + i));
+        int equal = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(value, target)));
+        if (equal) {
+            return i + __builtin_ctz(equal);
+        }
+    }
+    for (; i < count; i++) {
+        if (scores[i] == best) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+#endif
+
+int selectScoreKernels(ScoreKernels kernels) {
+    if (kernels == SCORE_KERNELS_AVX2) {
+#ifdef HAVE_AVX2_KERNELS
+        if (!__builtin_cpu_supports("avx2")) {
+            return -1;
+        }
+        // AVX2 has no scatter: the histogram adds stay scalar, which
+        // measured faster than masking blocks and scattering lane by lane
+        active.sumByUser = sumByUserScalar;
+        active.sumValueStats = sumValueStatsAvx2;
+        active.argmax = argmaxAvx2;
+#else
+        return -1;
+#endif
+    } else {
+        active.sumByUser = sumByUserScalar;
+        active.sumValueStats = sumValueStatsScalar;
+        active.argmax = argmaxScalar;
+    }
+
+    active.kernels = kernels;
+    active.chosen = 1;
+    return 0;
+}
+
+static pthread_once_t defaultKernelsOnce = PTHREAD_ONCE_INIT;
+
+static void selectDefaultKernels(void) {
+    if (!active.chosen && selectScoreKernels(SCORE_KERNELS_AVX2) == -1) {
+        selectScoreKernels(SCORE_KERNELS_SCALAR);
+    }
+}
+
+// Pick the widest kernels the CPU runs the first time any kernel is used,
+// unless a set was selected explicitly
+static void ensureKernels(void) {
+    pthread_once(&defaultKernelsOnce, selectDefaultKernels);
+}
+
+const char *scoreKernelsName(void) {
+    ensureKernels();
+    return active.kernels == SCORE_KERNELS_AVX2 ? "avx2" : "scalar";
+}
+
+void sumByUser(const uint32_t *userIds, const int32_t *values, int start, int end,
+               uint32_t userCount, long long *scores, int *counts, int *firstRows) {
+    ensureKernels();
+    active.sumByUser(userIds, values, start, end, userCount, scores, counts, firstRows);
+}
+
+void sumValueStats(const uint32_t *userIds, const int32_t *values, int start, int end,
+                   uint32_t userCount, ValueStats *stats) {
+    ensureKernels();
+    active.sumValueStats(userIds, values, start, end, userCount, stats);
+}
+
+int argmaxScore(const long long *scores, int count) {
+    ensureKernels();
+    return active.argmax(scores, count);
+}
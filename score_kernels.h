@@ -0,0 +1,46 @@
+#ifndef SCORE_KERNELS_H
+#define SCORE_KERNELS_H
+
+#include <stdint.h>
+
+// Aggregation kernels over the column arrays of a hunt. Each has a scalar
+// version and, on x86, most have an AVX2 one; the AVX2 versions are picked
+// at first use when the CPU supports them and give identical results.
+
+typedef enum {
+    SCORE_KERNELS_SCALAR,
+    SCORE_KERNELS_AVX2
+} ScoreKernels;
+
+// Totals over the live values of a hunt
+typedef struct {
+    long long total;
+    long long count;
+    int min;
+    int max;
+} ValueStats;
+
+// Switch kernels, returns -1 if the CPU cannot run the requested set
+int selectScoreKernels(ScoreKernels kernels);
+
+// Kernels in use, as a name for reports
+const char *scoreKernelsName(void);
+
+void initValueStats(ValueStats *stats);
+
+void mergeValueStats(ValueStats *stats, const ValueStats *other);
+
+// Per-user sums over rows [start, end): rows whose code is not below
+// userCount are removed treasures and skipped. firstRows gets the row at
+// which a user's count went from 0 to 1.
+void sumByUser(const uint32_t *userIds, const int32_t *values, int start, int end,
+               uint32_t userCount, long long *scores, int *counts, int *firstRows);
+
+// Fold the live values of rows [start, end) into stats
+void sumValueStats(const uint32_t *userIds, const int32_t *values, int start, int end,
+                   uint32_t userCount, ValueStats *stats);
+
+// Index of the first maximum of scores, or -1 when count is 0
+int argmaxScore(const long long *scores, int count);
+
+#endif
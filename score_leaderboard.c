@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "score_cache.h"
+#include "score_hunt.h"
+#include "score_leaderboard.h"
+
+static int compareNames(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int findAllHunts(char ***hunts) {
+    DIR *dir = opendir(".");
+    if (dir == NULL) {
+        return -1;
+    }
+
+    char **names = NULL;
+    int count = 0;
+    int capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' || strlen(entry->d_name) > 255) {
+            continue;
+        }
+
+        char treasureFile[300];
+        struct stat st;
+        snprintf(treasureFile, sizeof(treasureFile), "%s/treasures", entry->d_name);
+        if (stat(treasureFile, &st) == -1 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            char **grown = realloc(names, capacity * sizeof(char *));
+            if (grown == NULL) {
+                break;
+            }
+            names = grown;
+        }
+        if ((names[count] = strdup(entry->d_name)) == NULL) {
+            break;
+        }
+        count++;
+    }
+    closedir(dir);
+
+    if (entry != NULL) {
+        for (int i = 0; i < count; i++) {
+            free(names[i]);
+        }
+        free(names);
+        return -1;
+    }
+
+    qsort(names, count, sizeof(char *), compareNames);
+    *hunts = names;
+    return count;
+}
+
+// Hunts handed out to the scoring threads
+typedef struct {
+    char **hunts;
+    int count;
+    atomic_int next;
+} HuntQueue;
+
+// One scoring thread and the totals of the hunts it scored
+typedef struct {
+    HuntQueue *queue;
+    ScoreTable table;
+    int huntCount;
+    int failedCount;
+    long long treasureCount;
+} LeaderboardJob;
+
+static void *scoreHuntsThread(void *arg) {
+    LeaderboardJob *job = arg;
+    HuntQueue *queue = job->queue;
+
+    int index;
+    while ((index = atomic_fetch_add(&queue->next, 1)) < queue->count) {
+        // Hunts are scored one per thread, so each uses a single job; the
+        // score cache answers most of them without reading any record
+        ScoreCache cache;
+        int scored = scoreHunt(queue->hunts[index], 1, &cache);
+        for (int i = 0; scored == 0 && i < cache.table.userCount; i++) {
+            if (cache.table.users[i].count > 0 && mergeUserScore(&job->table, &cache.table.users[i]) == -1) {
+                scored = -2;
+            }
+        }
+
+        if (scored == 0) {
+            job->huntCount++;
+            job->treasureCount += cache.stats.count;
+        } else {
+            fprintf(stderr, "Error: Failed to score hunt '%s'\n", queue->hunts[index]);
+            job->failedCount++;
+        }
+        freeScoreCache(&cache);
+    }
+    return NULL;
+}
+
+int scoreHunts(char **hunts, int count, int threads, Leaderboard *board) {
+    memset(board, 0, sizeof(*board));
+    initScoreTable(&board->table);
+
+    if (threads > count) {
+        threads = count;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    HuntQueue queue;
+    queue.hunts = hunts;
+    queue.count = count;
+    atomic_init(&queue.next, 0);
+
+    LeaderboardJob *jobs = calloc(threads, sizeof(LeaderboardJob));
+    pthread_t *ids = calloc(threads, sizeof(pthread_t));
+    if (jobs == NULL || ids == NULL) {
+        free(jobs);
+        free(ids);
+        return -1;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        jobs[i].queue = &queue;
+        initScoreTable(&jobs[i].table);
+    }
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&ids[i], NULL, scoreHuntsThread, &jobs[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+    // Whatever no thread could be started for is scored right here
+    if (started < threads) {
+        scoreHuntsThread(&jobs[started]);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < threads; i++) {
+        if (i < started) {
+            pthread_join(ids[i], NULL);
+        }
+        for (int u = 0; u < jobs[i].table.userCount && !failed; u++) {
+            failed = mergeUserScore(&board->table, &jobs[i].table.users[u]) == -1;
+        }
+        board->huntCount += jobs[i].huntCount;
+        board->failedCount += jobs[i].failedCount;
+        board->treasureCount += jobs[i].treasureCount;
+        freeScoreTable(&jobs[i].table);
+    }
+
+    free(jobs);
+    free(ids);
+    return failed ? -1 : 0;
+}
+
+int printLeaderboard(FILE *out, const Leaderboard *board, const ScoreRanking *ranking, OutputFormat format) {
+    const ScoreTable *table = &board->table;
+    int count = rankedCount(table, ranking);
+    int *order = malloc((count > 0 ? count : 1) * sizeof(int));
+    long *ranks = malloc((count > 0 ? count : 1) * sizeof(long));
+    if (order == NULL || ranks == NULL) {
+        fprintf(stderr, "Error: Out of memory while ranking users\n");
+        free(order);
+        free(ranks);
+        return 1;
+    }
+    int shown = rankUsers(table, ranking, order);
+    numberRanks(table, order, shown, ranking->style, ranks);
+    char json[USER_SCORE_JSON_MAX + 2];
+
+    if (format == OUTPUT_TEXT) {
+        fprintf(out, "Leaderboard over %d hunts: %d users, %lld treasures\n",
+                board->huntCount, table->userCount, board->treasureCount);
+        fprintf(out, "-----------------------------------\n");
+        if (shown == 0) {
+            fprintf(out, "No treasures found in these hunts.\n");
+        }
+        for (int i = 0; i < shown; i++) {
+            const UserScore *user = &table->users[order[i]];
+            fprintf(out, "%4ld. %-15s Score: %lld  Treasures: %d\n", ranks[i], user->userName, user->score, user->count);
+        }
+        fprintf(out, "-----------------------------------\n");
+    } else if (format == OUTPUT_BINARY) {
+        for (int i = 0; i < shown; i++) {
+            const UserScore *user = &table->users[order[i]];
+            ScoreRecord record;
+            memset(&record, 0, sizeof(record));
+            memcpy(record.userName, user->userName, sizeof(record.userName));
+            record.count = user->count;
+            record.score = user->score;
+            fwrite(&record, sizeof(record), 1, out);
+        }
+    } else if (format == OUTPUT_NDJSON) {
+        for (int i = 0; i < shown; i++) {
+            size_t length = formatUserScoreJson(NULL, ranks[i], &table->users[order[i]], json);
+            json[length++] = '\n';
+            fwrite(json, 1, length, out);
+        }
+    } else {
+        char *end = json;
+        memcpy(end, "{\"hunts\":", 9);
+        end = appendJsonInt(end + 9, board->huntCount);
+        memcpy(end, ",\"users\":", 9);
+        end = appendJsonInt(end + 9, table->userCount);
+        memcpy(end, ",\"treasures\":", 13);
+        end = appendJsonInt(end + 13, board->treasureCount);
+        memcpy(end, ",\"leaderboard\":[", 16);
+        fwrite(json, 1, end + 16 - json, out);
+
+        for (int i = 0; i < shown; i++) {
+            size_t length = 0;
+            if (i > 0) {
+                json[length++] = ',';
+            }
+            json[length++] = '\n';
+            length += formatUserScoreJson(NULL, ranks[i], &table->users[order[i]], json + length);
+            fwrite(json, 1, length, out);
+        }
+        fputs(shown == 0 ? "]}\n" : "\n]}\n", out);
+    }
+
+    free(order);
+    free(ranks);
+    return 0;
+}
+
+void freeLeaderboard(Leaderboard *board) {
+    freeScoreTable(&board->table);
+}
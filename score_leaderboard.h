@@ -0,0 +1,33 @@
+#ifndef SCORE_LEADERBOARD_H
+#define SCORE_LEADERBOARD_H
+
+#include <stdio.h>
+
+#include "score_table.h"
+#include "score_rank.h"
+#include "treasure_output.h"
+
+// Per-user totals merged over many hunts
+typedef struct {
+    ScoreTable table;
+    int huntCount;  // hunts scored
+    int failedCount;  // hunts that could not be scored
+    long long treasureCount;
+} Leaderboard;
+
+// Names of the hunts under the working directory (directories holding a
+// treasures file), sorted. Returns their count, or -1 on error; the
+// caller frees each name and the array.
+int findAllHunts(char ***hunts);
+
+// Score the hunts on a pool of threads, each taking the next unscored
+// hunt, and merge every user's totals across them. Hunts that fail are
+// reported on stderr and counted.
+int scoreHunts(char **hunts, int count, int threads, Leaderboard *board);
+
+// Print the users a ranking picks, with their rank numbers
+int printLeaderboard(FILE *out, const Leaderboard *board, const ScoreRanking *ranking, OutputFormat format);
+
+void freeLeaderboard(Leaderboard *board);
+
+#endif
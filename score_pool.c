@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include "score_hunt.h"
+#include "score_pool.h"
+
+// Header of one frame on a worker pipe, followed by length bytes of hunt
+// name (monitor -> worker) or score report (worker -> monitor). A worker
+// quits on a name longer than MAX_HUNT_NAME; its hunt is reported failed.
+typedef struct {
+    unsigned int length;
+    unsigned int task;
+    unsigned int failed;  // the report is an error message
+} ScoreFrame;
+
+#define MAX_HUNT_NAME 255
+
+static int read_full(int fd, void *buffer, size_t length)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t n = read(fd, (char *)buffer + done, length - done);
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+// Write a frame header and its payload, retrying short writes
+static int write_frame(int fd, unsigned int task, int failed, const char *payload, size_t length)
+{
+    ScoreFrame frame;
+    frame.length = length;
+    frame.task = task;
+    frame.failed = failed;
+
+    struct iovec iov[2];
+    iov[0].iov_base = &frame;
+    iov[0].iov_len = sizeof(frame);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = length;
+
+    int index = 0;
+    while (index < 2)
+    {
+        ssize_t n = writev(fd, iov + index, 2 - index);
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        while (index < 2 && (size_t)n >= iov[index].iov_len)
+        {
+            n -= iov[index].iov_len;
+            index++;
+        }
+        if (index < 2)
+        {
+            iov[index].iov_base = (char *)iov[index].iov_base + n;
+            iov[index].iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// Worker main loop: score each hunt named on the task pipe into memory
+// and send the report back as one frame. Ends when the monitor goes away.
+static void run_score_worker(int task_fd, int result_fd)
+{
+    while (1)
+    {
+        ScoreFrame frame;
+        char hunt[MAX_HUNT_NAME + 1];
+        if (read_full(task_fd, &frame, sizeof(frame)) == -1 || frame.length > MAX_HUNT_NAME ||
+            read_full(task_fd, hunt, frame.length) == -1)
+        {
+            _exit(EXIT_SUCCESS);
+        }
+        hunt[frame.length] = '\0';
+
+        char *report = NULL;
+        size_t length = 0;
+        FILE *out = open_memstream(&report, &length);
+        if (out == NULL)
+        {
+            _exit(EXIT_FAILURE);
+        }
+        int scored = printHuntScores(out, hunt, 1, NULL, OUTPUT_TEXT) == 0;
+        fclose(out);
+
+        int failed = write_frame(result_fd, frame.task, !scored, report, length) == -1;
+        free(report);
+        if (failed)
+        {
+            _exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static int spawn_worker(ScorePool *pool, int index)
+{
+    int task_pipe[2];
+    int result_pipe[2];
+    if (pipe(task_pipe) == -1)
+    {
+        return -1;
+    }
+    if (pipe(result_pipe) == -1)
+    {
+        close(task_pipe[0]);
+        close(task_pipe[1]);
+        return -1;
+    }
+
+    // Nothing buffered in the monitor may be written twice
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        close(task_pipe[0]);
+        close(task_pipe[1]);
+        close(result_pipe[0]);
+        close(result_pipe[1]);
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        // Holding other workers' pipes would hide their EOF from them
+        for (int i = 0; i < pool->count; i++)
+        {
+            if (i != index && pool->workers[i].pid != -1)
+            {
+                close(pool->workers[i].task_fd);
+                close(pool->workers[i].result_fd);
+            }
+        }
+        close(task_pipe[1]);
+        close(result_pipe[0]);
+        run_score_worker(task_pipe[0], result_pipe[1]);
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(task_pipe[0]);
+    close(result_pipe[1]);
+    ScoreWorker *worker = &pool->workers[index];
+    worker->pid = pid;
+    worker->task_fd = task_pipe[1];
+    worker->result_fd = result_pipe[0];
+    worker->task = -1;
+    return 0;
+}
+
+static void retire_worker(ScoreWorker *worker)
+{
+    close(worker->task_fd);
+    close(worker->result_fd);
+    waitpid(worker->pid, NULL, 0);
+    worker->pid = -1;
+    worker->task = -1;
+}
+
+int score_pool_start(ScorePool *pool, int count)
+{
+    pool->workers = calloc(count, sizeof(ScoreWorker));
+    pool->count = count;
+    if (pool->workers == NULL)
+    {
+        pool->count = 0;
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        pool->workers[i].pid = -1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (spawn_worker(pool, i) == -1)
+        {
+            score_pool_stop(pool);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void score_pool_run(ScorePool *pool, char **hunts, int hunt_count,
+                    ScoreReportHandler handler, void *context)
+{
+    static const char worker_failed[] = "Error: Score worker failed\n";
+
+    // Reports that arrive early wait here until it is their turn. A hunt
+    // whose worker failed points at worker_failed, which is never freed.
+    char **reports = calloc(hunt_count, sizeof(char *));
+    size_t *lengths = calloc(hunt_count, sizeof(size_t));
+    char *failures = calloc(hunt_count, 1);
+    struct pollfd *polls = calloc(pool->count, sizeof(struct pollfd));
+    if (reports == NULL || lengths == NULL || failures == NULL || polls == NULL || pool->count == 0)
+    {
+        for (int i = 0; i < hunt_count; i++)
+        {
+            handler(worker_failed, sizeof(worker_failed) - 1, 1, context);
+        }
+        free(reports);
+        free(lengths);
+        free(failures);
+        free(polls);
+        return;
+    }
+
+    int next = 0;
+    int emitted = 0;
+    while (emitted < hunt_count)
+    {
+        // Keep every idle worker busy while hunts are left
+        int busy = 0;
+        for (int i = 0; i < pool->count; i++)
+        {
+            ScoreWorker *worker = &pool->workers[i];
+            if (worker->pid == -1 && spawn_worker(pool, i) == -1)
+            {
+                continue;
+            }
+            if (worker->task == -1 && next < hunt_count)
+            {
+                if (write_frame(worker->task_fd, next, 0, hunts[next], strlen(hunts[next])) == -1)
+                {
+                    retire_worker(worker);
+                    continue;
+                }
+                worker->task = next++;
+            }
+            if (worker->task != -1)
+            {
+                polls[busy].fd = worker->result_fd;
+                polls[busy].events = POLLIN;
+                polls[busy].revents = 0;
+                busy++;
+            }
+        }
+
+        if (busy > 0 && poll(polls, busy, -1) == -1 && errno != EINTR)
+        {
+            // No report can be waited for: reap the busy workers and
+            // report every hunt still outstanding as failed
+            for (int i = 0; i < pool->count; i++)
+            {
+                if (pool->workers[i].task != -1)
+                {
+                    retire_worker(&pool->workers[i]);
+                }
+            }
+            for (int task = emitted; task < hunt_count; task++)
+            {
+                if (reports[task] == NULL)
+                {
+                    reports[task] = (char *)worker_failed;
+                    lengths[task] = sizeof(worker_failed) - 1;
+                    failures[task] = 1;
+                }
+            }
+            next = hunt_count;
+            busy = 0;
+        }
+
+        for (int i = 0; i < pool->count && busy > 0; i++)
+        {
+            ScoreWorker *worker = &pool->workers[i];
+            if (worker->task == -1)
+            {
+                continue;
+            }
+
+            int ready = 0;
+            for (int p = 0; p < busy; p++)
+            {
+                if (polls[p].fd == worker->result_fd && polls[p].revents != 0)
+                {
+                    ready = 1;
+                }
+            }
+            if (!ready)
+            {
+                continue;
+            }
+
+            // The worker writes each report as one frame, read it whole
+            int task = worker->task;
+            ScoreFrame frame;
+            char *report = NULL;
+            if (read_full(worker->result_fd, &frame, sizeof(frame)) == 0 && frame.task == (unsigned int)task &&
+                (report = malloc(frame.length + 1)) != NULL &&
+                read_full(worker->result_fd, report, frame.length) == 0)
+            {
+                reports[task] = report;
+                lengths[task] = frame.length;
+                failures[task] = frame.failed != 0;
+                worker->task = -1;
+                continue;
+            }
+
+            free(report);
+            reports[task] = (char *)worker_failed;
+            lengths[task] = sizeof(worker_failed) - 1;
+            failures[task] = 1;
+            retire_worker(worker);
+        }
+
+        while (emitted < hunt_count && reports[emitted] != NULL)
+        {
+            handler(reports[emitted], lengths[emitted], failures[emitted], context);
+            if (reports[emitted] != worker_failed)
+            {
+                free(reports[emitted]);
+            }
+            reports[emitted] = NULL;
+            emitted++;
+        }
+
+        // No worker could be started; report what is left as failed
+        if (busy == 0 && emitted < hunt_count && reports[emitted] == NULL)
+        {
+            handler(worker_failed, sizeof(worker_failed) - 1, 1, context);
+            emitted++;
+            next = next > emitted ? next : emitted;
+        }
+    }
+
+    for (int i = emitted; i < hunt_count; i++)
+    {
+        if (reports[i] != worker_failed)
+        {
+            free(reports[i]);
+        }
+    }
+    free(reports);
+    free(lengths);
+    free(failures);
+    free(polls);
+}
+
+void score_pool_stop(ScorePool *pool)
+{
+    for (int i = 0; i < pool->count; i++)
+    {
+        if (pool->workers[i].pid != -1)
+        {
+            retire_worker(&pool->workers[i]);
+        }
+    }
+    free(pool->workers);
+    pool->workers = NULL;
+    pool->count = 0;
+}
@@ -0,0 +1,40 @@
+#ifndef SCORE_POOL_H
+#define SCORE_POOL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// One pre-forked score worker. The monitor writes hunt names to task_fd
+// and reads the finished score reports back from result_fd.
+typedef struct {
+    pid_t pid;
+    int task_fd;
+    int result_fd;
+    int task;  // index of the hunt being scored, -1 while idle
+} ScoreWorker;
+
+// Pool of score workers forked once when the monitor starts, so scoring
+// many hunts costs one pipe round trip per hunt instead of a fork/exec
+typedef struct {
+    ScoreWorker *workers;
+    int count;
+} ScorePool;
+
+// Called with each report, in the order the hunts were given; failed is
+// set when the report is an error rather than the hunt's scores
+typedef void (*ScoreReportHandler)(const char *report, size_t length, int failed, void *context);
+
+// Fork count workers. Returns 0 or -1.
+int score_pool_start(ScorePool *pool, int count);
+
+// Score the hunts on the pool, one hunt per idle worker at a time, and hand
+// the reports to handler as soon as every earlier hunt's report is in.
+// Hunt names are at most 255 bytes long.
+// A worker that dies is replaced and its hunt reported as failed.
+void score_pool_run(ScorePool *pool, char **hunts, int hunt_count,
+                    ScoreReportHandler handler, void *context);
+
+// Close the task pipes and wait for the workers to exit
+void score_pool_stop(ScorePool *pool);
+
+#endif
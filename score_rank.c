@@ -0,0 +1,186 @@
+#include <string.h>
+
+#include "score_rank.h"
+
+// Ranges this short are finished by insertion sort
+#define INSERTION_SORT_LIMIT 16
+
+int parseRankStyle(const char *name, RankStyle *style) {
+    if (strcmp(name, "competition") == 0) {
+        *style = RANK_COMPETITION;
+    } else if (strcmp(name, "dense") == 0) {
+        *style = RANK_DENSE;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int userRanksBefore(const UserScore *a, const UserScore *b) {
+    if (a->score != b->score) {
+        return a->score > b->score;
+    }
+    return strcmp(a->userName, b->userName) < 0;
+}
+
+static void swapUsers(int *order, int a, int b) {
+    int swap = order[a];
+    order[a] = order[b];
+    order[b] = swap;
+}
+
+// Restore the heap below position at. The heap keeps the user that ranks
+// last on top, so taking the top off repeatedly leaves the range best
+// first, and in topUsers a better user can replace it in O(log k).
+static void siftDown(const UserScore *users, int *heap, int size, int at) {
+    while (1) {
+        int worst = at;
+        int left = 2 * at + 1;
+        int right = left + 1;
+        if (left < size && userRanksBefore(&users[heap[worst]], &users[heap[left]])) {
+            worst = left;
+        }
+        if (right < size && userRanksBefore(&users[heap[worst]], &users[heap[right]])) {
+            worst = right;
+        }
+        if (worst == at) {
+            return;
+        }
+        swapUsers(heap, at, worst);
+        at = worst;
+    }
+}
+
+// Move the top of the heap to the end until it is empty: best first
+static void drainHeap(const UserScore *users, int *heap, int size) {
+    for (int end = size - 1; end > 0; end--) {
+        swapUsers(heap, 0, end);
+        siftDown(users, heap, end, 0);
+    }
+}
+
+int topUsers(const ScoreTable *table, int k, int *order) {
+    const UserScore *users = table->users;
+    int size = 0;
+
+    for (int i = 0; i < table->userCount && k > 0; i++) {
+        if (size < k) {
+            // Sift the new user up to its place
+            int at = size++;
+            order[at] = i;
+            while (at > 0 && userRanksBefore(&users[order[(at - 1) / 2]], &users[order[at]])) {
+                swapUsers(order, at, (at - 1) / 2);
+                at = (at - 1) / 2;
+            }
+        } else if (userRanksBefore(&users[i], &users[order[0]])) {
+            order[0] = i;
+            siftDown(users, order, size, 0);
+        }
+    }
+
+    drainHeap(users, order, size);
+    return size;
+}
+
+static void insertionSort(const UserScore *users, int *order, int start, int end) {
+    for (int i = start + 1; i < end; i++) {
+        int user = order[i];
+        int at = i;
+        while (at > start && userRanksBefore(&users[user], &users[order[at - 1]])) {
+            order[at] = order[at - 1];
+            at--;
+        }
+        order[at] = user;
+    }
+}
+
+// Sort order[start, end). Recurses into the smaller side of each split
+// and loops on the larger one, so the stack stays O(log n).
+static void introSort(const UserScore *users, int *order, int start, int end, int depth) {
+    while (end - start > INSERTION_SORT_LIMIT) {
+        if (depth-- == 0) {
+            int size = end - start;
+            for (int at = size / 2 - 1; at >= 0; at--) {
+                siftDown(users, order + start, size, at);
+            }
+            drainHeap(users, order + start, size);
+            return;
+        }
+
+        // Median of the first, middle and last user as the pivot
+        int middle = start + (end - start) / 2;
+        if (userRanksBefore(&users[order[middle]], &users[order[start]])) {
+            swapUsers(order, middle, start);
+        }
+        if (userRanksBefore(&users[order[end - 1]], &users[order[middle]])) {
+            swapUsers(order, end - 1, middle);
+            if (userRanksBefore(&users[order[middle]], &users[order[start]])) {
+                swapUsers(order, middle, start);
+            }
+        }
+        // Only order is permuted, so the pivot stays where it is in users
+        const UserScore *pivot = &users[order[middle]];
+
+        // Hoare partition. Names are unique, so no two users tie and the
+        // median (never the last in rank) leaves both sides non-empty.
+        int left = start - 1;
+        int right = end;
+        while (1) {
+            do {
+                left++;
+            } while (userRanksBefore(&users[order[left]], pivot));
+            do {
+                right--;
+            } while (userRanksBefore(pivot, &users[order[right]]));
+            if (left >= right) {
+                break;
+            }
+            swapUsers(order, left, right);
+        }
+
+        if (right + 1 - start < end - right - 1) {
+            introSort(users, order, start, right + 1, depth);
+            start = right + 1;
+        } else {
+            introSort(users, order, right + 1, end, depth);
+            end = right + 1;
+        }
+    }
+    insertionSort(users, order, start, end);
+}
+
+void sortUsers(const ScoreTable *table, int *order) {
+    int depth = 0;
+    for (int size = table->userCount; size > 1; size >>= 1) {
+        depth += 2;
+    }
+    for (int i = 0; i < table->userCount; i++) {
+        order[i] = i;
+    }
+    introSort(table->users, order, 0, table->userCount, depth);
+}
+
+int rankedCount(const ScoreTable *table, const ScoreRanking *ranking) {
+    return ranking->top > 0 && ranking->top < table->userCount ? ranking->top : table->userCount;
+}
+
+int rankUsers(const ScoreTable *table, const ScoreRanking *ranking, int *order) {
+    int count = rankedCount(table, ranking);
+    if (count < table->userCount) {
+        return topUsers(table, count, order);
+    }
+    sortUsers(table, order);
+    return count;
+}
+
+void numberRanks(const ScoreTable *table, const int *order, int count, RankStyle style, long *ranks) {
+    for (int i = 0; i < count; i++) {
+        if (i > 0 && table->users[order[i]].score == table->users[order[i - 1]].score) {
+            ranks[i] = ranks[i - 1];
+        } else if (style == RANK_DENSE) {
+            ranks[i] = i > 0 ? ranks[i - 1] + 1 : 1;
+        } else {
+            ranks[i] = i + 1;
+        }
+    }
+}
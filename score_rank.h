@@ -0,0 +1,45 @@
+#ifndef SCORE_RANK_H
+#define SCORE_RANK_H
+
+#include "score_table.h"
+
+// How tied users are numbered: competition ranking ("1224") skips the
+// places a tie takes up, dense ranking ("1223") does not
+typedef enum {
+    RANK_COMPETITION,
+    RANK_DENSE
+} RankStyle;
+
+// Which users a report shows, in rank order
+typedef struct {
+    int top;  // the best top users, 0 for all of them
+    RankStyle style;
+} ScoreRanking;
+
+// Parse a rank style name ("competition" or "dense"). Returns 0 or -1.
+int parseRankStyle(const char *name, RankStyle *style);
+
+// 1 if a ranks above b: higher score first, then the name in byte order,
+// so equal scores always come out the same way
+int userRanksBefore(const UserScore *a, const UserScore *b);
+
+// The k best users of a table, best first, into order (k entries) as
+// indexes into table->users. A bounded heap keeps it O(users log k).
+// Returns how many were found (fewer than k if there are fewer users).
+int topUsers(const ScoreTable *table, int k, int *order);
+
+// Every user of a table, best first, into order (userCount entries).
+// Introsort: quicksort with a median of three, heapsort once the
+// recursion gets too deep, insertion sort for short ranges.
+void sortUsers(const ScoreTable *table, int *order);
+
+// The users a ranking shows into order, which has room for
+// rankedCount(table, ranking) entries. Returns how many there are.
+int rankUsers(const ScoreTable *table, const ScoreRanking *ranking, int *order);
+int rankedCount(const ScoreTable *table, const ScoreRanking *ranking);
+
+// Rank numbers of users already in rank order. Users with the same score
+// share a rank.
+void numberRanks(const ScoreTable *table, const int *order, int count, RankStyle style, long *ranks);
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "score_table.h"
+
+#define INITIAL_SLOTS 64
+
+// FNV-1a over the user name
+static unsigned int hashUserName(const char *userName) {
+    unsigned int hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)userName; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void initScoreTable(ScoreTable *table) {
+    memset(table, 0, sizeof(*table));
+}
+
+// Rehash every user into a slot array twice as large
+static int growSlots(ScoreTable *table) {
+    int slotCount = table->slotCount ? table->slotCount * 2 : INITIAL_SLOTS;
+    int *slots = malloc(slotCount * sizeof(int));
+    if (slots == NULL) {
+        return -1;
+    }
+    memset(slots, -1, slotCount * sizeof(int));
+
+    for (int i = 0; i < table->userCount; i++) {
+        unsigned int slot = table->users[i].hash & (slotCount - 1);
+        while (slots[slot] != -1) {
+            slot = (slot + 1) & (slotCount - 1);
+        }
+        slots[slot] = i;
+    }
+
+    free(table->slots);
+    table->slots = slots;
+    table->slotCount = slotCount;
+    return 0;
+}
+
+// Linear probing; returns the slot holding the user or the empty slot where it belongs
+static unsigned int probe(const ScoreTable *table, const char *userName, unsigned int hash) {
+    unsigned int slot = hash & (table->slotCount - 1);
+    while (table->slots[slot] != -1) {
+        const UserScore *user = &table->users[table->slots[slot]];
+        if (user->hash == hash && strcmp(user->userName, userName) == 0) {
+            break;
+        }
+        slot = (slot + 1) & (table->slotCount - 1);
+    }
+    return slot;
+}
+
+UserScore *findUserScore(ScoreTable *table, const char *userName) {
+    if (table->slotCount == 0) {
+        return NULL;
+    }
+    unsigned int slot = probe(table, userName, hashUserName(userName));
+    return table->slots[slot] == -1 ? NULL : &table->users[table->slots[slot]];
+}
+
+// Find a user's entry, appending a zeroed one the first time a name is seen
+static UserScore *findOrAddUser(ScoreTable *table, const char *userName) {
+    if ((table->userCount + 1) * 10 > table->slotCount * 7 && growSlots(table) == -1) {
+        return NULL;
+    }
+
+    unsigned int hash = hashUserName(userName);
+    unsigned int slot = probe(table, userName, hash);
+
+    if (table->slots[slot] == -1) {
+        // New user
+        if (table->userCount == table->userCapacity) {
+            int capacity = table->userCapacity ? table->userCapacity * 2 : INITIAL_SLOTS;
+            UserScore *users = realloc(table->users, capacity * sizeof(UserScore));
+            if (users == NULL) {
+                return NULL;
+            }
+            table->users = users;
+            table->userCapacity = capacity;
+        }
+
+        UserScore *user = &table->users[table->userCount];
+        strncpy(user->userName, userName, sizeof(user->userName) - 1);
+        user->userName[sizeof(user->userName) - 1] = '\0';
+        user->hash = hash;
+        user->score = 0;
+        user->count = 0;
+        table->slots[slot] = table->userCount++;
+    }
+
+    return &table->users[table->slots[slot]];
+}
+
+int addScore(ScoreTable *table, const char *userName, long long value) {
+    UserScore *user = findOrAddUser(table, userName);
+    if (user == NULL) {
+        return -1;
+    }
+    user->score += value;
+    user->count++;
+    return 0;
+}
+
+int mergeUserScore(ScoreTable *table, const UserScore *other) {
+    UserScore *user = findOrAddUser(table, other->userName);
+    if (user == NULL) {
+        return -1;
+    }
+    user->score += other->score;
+    user->count += other->count;
+    return 0;
+}
+
+int internUserName(ScoreTable *table, const char *userName) {
+    UserScore *user = findOrAddUser(table, userName);
+    return user == NULL ? -1 : (int)(user - table->users);
+}
+
+void freeScoreTable(ScoreTable *table) {
+    free(table->users);
+    free(table->slots);
+    memset(table, 0, sizeof(*table));
+}
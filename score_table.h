@@ -0,0 +1,40 @@
+#ifndef SCORE_TABLE_H
+#define SCORE_TABLE_H
+
+// Per-user score totals, kept in the order users were first seen
+typedef struct {
+    char userName[50];
+    unsigned int hash;
+    long long score;
+    int count;
+} UserScore;
+
+// Open-addressing hash map from userName to its UserScore entry.
+// slots holds indexes into users (-1 for an empty slot) and is grown
+// whenever it gets more than 70% full.
+typedef struct {
+    UserScore *users;
+    int userCount;
+    int userCapacity;
+    int *slots;
+    int slotCount;
+} ScoreTable;
+
+void initScoreTable(ScoreTable *table);
+
+// Add one treasure value to a user's total, creating the user if needed
+int addScore(ScoreTable *table, const char *userName, long long value);
+
+// Fold another table's entry (score and treasure count) into this table
+int mergeUserScore(ScoreTable *table, const UserScore *other);
+
+// Look up a user, returning NULL if they are not in the table
+UserScore *findUserScore(ScoreTable *table, const char *userName);
+
+// Position of a user in first-seen order, adding them if needed; a stable
+// dictionary code for the name. Returns -1 when out of memory.
+int internUserName(ScoreTable *table, const char *userName);
+
+void freeScoreTable(ScoreTable *table);
+
+#endif
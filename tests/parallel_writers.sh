@@ -0,0 +1,67 @@
+#!/bin/sh
+# 64 writer processes append to one hunt at once, each with single --add
+# calls and --add-batch imports, while compactions rewrite the file under
+# them. Checks that the IDs handed out are exactly 1..N and that no
+# treasure was lost, by comparing every writer's score with what it wrote.
+set -e
+BIN=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+export LC_ALL=C
+
+WRITERS=64
+ADDS=4
+BATCHES=2
+BATCH_SIZE=25
+
+writer() {
+    w=$1
+    a=0
+    while [ $a -lt $ADDS ]; do
+        printf 'writer%d\n45.5\n25.5\nclue %d\n%d\n' $w $a $((w * 10 + a)) |
+            "$BIN/treasure_manager" --add stress > /dev/null
+        a=$((a + 1))
+    done
+    b=0
+    while [ $b -lt $BATCHES ]; do
+        awk -v w=$w -v b=$b -v n=$BATCH_SIZE 'BEGIN {
+            for (i = 0; i < n; i++) printf "writer%d,45.5,25.5,%d,batch %d\n", w, b * n + i + 1, i
+        }' > batch.$w.$b.csv
+        "$BIN/treasure_manager" --add-batch stress batch.$w.$b.csv > /dev/null
+        b=$((b + 1))
+    done
+}
+
+"$BIN/treasure_manager" --add-batch stress /dev/null > /dev/null
+w=1
+while [ $w -le $WRITERS ]; do
+    writer $w &
+    w=$((w + 1))
+done
+for c in 1 2 3 4; do
+    "$BIN/treasure_manager" --compact stress > /dev/null &
+done
+wait
+
+COUNT=$((WRITERS * (ADDS + BATCHES * BATCH_SIZE)))
+"$BIN/treasure_manager" --list stress --compact | awk -F'\t' '/^[0-9]+\t/ { print $1 }' | sort -n > ids
+if ! seq 1 $COUNT | cmp -s - ids; then
+    echo "FAIL: IDs are not exactly 1..$COUNT ($(wc -l < ids) listed, $(sort -un ids | wc -l) distinct)"
+    exit 1
+fi
+
+# Each writer's score: its --add values plus 1..BATCHES*BATCH_SIZE
+w=1
+while [ $w -le $WRITERS ]; do
+    echo "writer$w $((ADDS * w * 10 + ADDS * (ADDS - 1) / 2 + BATCHES * BATCH_SIZE * (BATCHES * BATCH_SIZE + 1) / 2))"
+    w=$((w + 1))
+done | sort > expected
+"$BIN/score_calculator" stress | awk '$1 == "User:" { print $2, $4 }' | sort > actual
+if ! cmp -s expected actual; then
+    echo "FAIL: per-writer scores differ"
+    diff expected actual | head
+    exit 1
+fi
+
+echo "PASS: $WRITERS writers, $COUNT treasures"
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Scores a hunt with 100k distinct users, two treasures each, and checks
+# every user's score and the hunt totals against sums worked out by awk.
+# Runs with one and with four scoring threads, each from a cold cache.
+set -e
+BIN=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+export LC_ALL=C
+
+USERS=100000
+awk -v n=$USERS 'BEGIN {
+    for (i = 0; i < 2 * n; i++)
+        printf "user%d,45.5,25.5,%d,clue %d\n", i % n, (i * 7919) % 1000 + 1, i
+}' > batch.csv
+"$BIN/treasure_manager" --add-batch many batch.csv > /dev/null
+
+awk -F, '{ score[$1] += $4 } END { for (u in score) print u, score[u] }' batch.csv | sort > expected
+TOTAL=$(awk -F, '{ total += $4 } END { print total }' batch.csv)
+
+for jobs in 1 4; do
+    rm -f many/scores.cache
+    "$BIN/score_calculator" -j $jobs many > report
+    awk '$1 == "User:" { print $2, $4 }' report | sort > actual
+    if ! cmp -s expected actual; then
+        echo "FAIL: per-user scores differ with -j $jobs"
+        diff expected actual | head
+        exit 1
+    fi
+    if ! grep -q "^Treasures: $((2 * USERS))  Total value: $TOTAL " report; then
+        echo "FAIL: wrong hunt totals with -j $jobs"
+        grep "^Treasures:" report
+        exit 1
+    fi
+done
+
+echo "PASS: $USERS users scored"
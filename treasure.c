@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "treasure.h"
+
+static void put16(unsigned char* p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void put32(unsigned char* p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static uint16_t get16(const unsigned char* p)
+{
+    return p[0] | (uint16_t)p[1] << 8;
+}
+
+static uint32_t get32(const unsigned char* p)
+{
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void putFloat(unsigned char* p, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put32(p, bits);
+}
+
+static float getFloat(const unsigned char* p)
+{
+    uint32_t bits = get32(p);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void initTreasureFileHeader(TreasureFileHeader* header)
+{
+    header->version = TREASURE_FORMAT_VERSION;
+    header->schemaFlags = TREASURE_SCHEMA_COMPACT | TREASURE_SCHEMA_LITTLE_ENDIAN;
+    header->headerSize = TREASURE_HEADER_SIZE;
+    header->recordCount = 0;
+}
+
+int decodeTreasureFileHeader(const unsigned char* bytes, size_t length, TreasureFileHeader* header)
+{
+    if (length < TREASURE_HEADER_SIZE || memcmp(bytes, TREASURE_MAGIC, 4) != 0)
+    {
+        return -1;
+    }
+
+    header->version = get16(bytes + 4);
+    header->schemaFlags = get16(bytes + 6);
+    header->headerSize = get32(bytes + 8);
+    header->recordCount = get32(bytes + 16) | (uint64_t)get32(bytes + 20) << 32;
+
+    //Only the layout this code writes is understood
+    if (header->version != TREASURE_FORMAT_VERSION ||
+        header->headerSize < TREASURE_HEADER_SIZE ||
+        !(header->schemaFlags & TREASURE_SCHEMA_LITTLE_ENDIAN))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+void encodeTreasureFileHeader(const TreasureFileHeader* header, unsigned char* bytes)
+{
+    memset(bytes, 0, TREASURE_HEADER_SIZE);
+    memcpy(bytes, TREASURE_MAGIC, 4);
+    put16(bytes + 4, header->version);
+    put16(bytes + 6, header->schemaFlags);
+    put32(bytes + 8, header->headerSize);
+    put32(bytes + 16, (uint32_t)header->recordCount);
+    put32(bytes + 20, (uint32_t)(header->recordCount >> 32));
+}
+
+int readTreasureFileHeader(int fd, TreasureFileHeader* header)
+{
+    unsigned char bytes[TREASURE_HEADER_SIZE];
+    ssize_t got = pread(fd, bytes, sizeof(bytes), 0);
+    if (got == -1)
+    {
+        return -1;
+    }
+    if (got == 0)
+    {
+        return 0;
+    }
+    return decodeTreasureFileHeader(bytes, got, header) == 0 ? 2 : 1;
+}
+
+int writeTreasureFileHeader(int fd, const TreasureFileHeader* header)
+{
+    unsigned char bytes[TREASURE_HEADER_SIZE];
+    encodeTreasureFileHeader(header, bytes);
+    return pwrite(fd, bytes, sizeof(bytes), 0) == sizeof(bytes) ? 0 : -1;
+}
+
+int createTempFile(const char* path, char* tempPath)
+{
+    snprintf(tempPath, TREASURE_TEMP_PATH_MAX, "%s.tmp.XXXXXX", path);
+    int fd = mkstemp(tempPath);
+    //mkstemp() creates the file 0600, the files it replaces are 0644
+    if (fd != -1)
+    {
+        fchmod(fd, 0644);
+    }
+    return fd;
+}
+
+size_t encodeTreasure(const Treasure* treasure, unsigned char* out)
+{
+    size_t userLength = strnlen(treasure->userName, 49);
+    size_t clueLength = strnlen(treasure->clueText, 199);
+    size_t length = TREASURE_RECORD_FIXED + userLength + clueLength;
+    int deleted = TREASURE_IS_DELETED(treasure);
+
+    put16(out, length);
+    out[TREASURE_RECORD_FLAGS_AT] = deleted ? TREASURE_RECORD_DELETED : 0;
+    out[3] = userLength;
+    out[4] = clueLength;
+    put32(out + 5, deleted ? -treasure->treasureId : treasure->treasureId);
+    putFloat(out + 9, treasure->latitude);
+    putFloat(out + 13, treasure->longitude);
+    put32(out + 17, treasure->value);
+    memcpy(out + TREASURE_RECORD_FIXED, treasure->userName, userLength);
+    memcpy(out + TREASURE_RECORD_FIXED + userLength, treasure->clueText, clueLength);
+
+    return length;
+}
+
+size_t decodeTreasure(const unsigned char* bytes, size_t available, Treasure* treasure)
+{
+    if (available < TREASURE_RECORD_FIXED)
+    {
+        return 0;
+    }
+
+    size_t length = get16(bytes);
+    size_t userLength = bytes[3];
+    size_t clueLength = bytes[4];
+    if (length != TREASURE_RECORD_FIXED + userLength + clueLength || length > available ||
+        userLength >= sizeof(treasure->userName) || clueLength >= sizeof(treasure->clueText))
+    {
+        return 0;
+    }
+
+    //Removed records come back with the negated ID, like TREASURE_IS_DELETED expects
+    int id = (int)get32(bytes + 5);
+    treasure->treasureId = (bytes[TREASURE_RECORD_FLAGS_AT] & TREASURE_RECORD_DELETED) ? -id : id;
+    treasure->latitude = getFloat(bytes + 9);
+    treasure->longitude = getFloat(bytes + 13);
+    treasure->value = (int)get32(bytes + 17);
+    memcpy(treasure->userName, bytes + TREASURE_RECORD_FIXED, userLength);
+    treasure->userName[userLength] = 0;
+    memcpy(treasure->clueText, bytes + TREASURE_RECORD_FIXED + userLength, clueLength);
+    treasure->clueText[clueLength] = 0;
+
+    return length;
+}
@@ -0,0 +1,82 @@
+#ifndef TREASURE_H
+#define TREASURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Structure treasure data, as the programs work with it in memory
+typedef struct {
+    int treasureId;
+    char userName[50];
+    float latitude;
+    float longitude;
+    char clueText[200];
+    int value;
+} Treasure;
+
+//Readers hand out removed treasures with their ID negated; the records stay
+//on disk until the hunt is compacted
+#define TREASURE_IS_DELETED(t) ((t)->treasureId <= 0)
+
+//On-disk format of <hunt>/treasures (version 2). All numbers are stored
+//little-endian whatever the host order.
+//
+//  header (32 bytes): magic "THNT", u16 version, u16 schema flags,
+//                     u32 header size, u64 record count, 8 reserved bytes
+//  record:            u16 record length, u8 flags, u8 user length,
+//                     u8 clue length, i32 id, f32 latitude, f32 longitude,
+//                     i32 value, then the user name and clue bytes (no NULs)
+//
+//Version 1 files have no header and hold raw Treasure structs; they are
+//still readable and are converted with --migrate.
+#define TREASURE_MAGIC "THNT"
+#define TREASURE_FORMAT_VERSION 2
+#define TREASURE_HEADER_SIZE 32
+#define TREASURE_RECORD_FIXED 21
+#define TREASURE_RECORD_MAX (TREASURE_RECORD_FIXED + 49 + 199)
+
+//Schema flags in the file header
+#define TREASURE_SCHEMA_COMPACT 0x0001
+#define TREASURE_SCHEMA_LITTLE_ENDIAN 0x0002
+
+//Record flags, TREASURE_RECORD_FLAGS_AT is the byte a tombstone rewrites
+#define TREASURE_RECORD_DELETED 0x01
+#define TREASURE_RECORD_FLAGS_AT 2
+
+typedef struct {
+    int version;
+    int schemaFlags;
+    uint32_t headerSize;
+    uint64_t recordCount;
+} TreasureFileHeader;
+
+//Header for a freshly created file
+void initTreasureFileHeader(TreasureFileHeader* header);
+
+//Parse a file header. Returns 0 for a current file, -1 if the bytes are
+//not a version 2 header (a legacy file).
+int decodeTreasureFileHeader(const unsigned char* bytes, size_t length, TreasureFileHeader* header);
+
+void encodeTreasureFileHeader(const TreasureFileHeader* header, unsigned char* bytes);
+
+//Read the header of an open treasures file. Returns 2 for a current file,
+//1 for a legacy file, 0 for an empty file and -1 on error.
+int readTreasureFileHeader(int fd, TreasureFileHeader* header);
+
+int writeTreasureFileHeader(int fd, const TreasureFileHeader* header);
+
+//Create a temp file next to path, named <path>.tmp.XXXXXX with a unique
+//suffix so concurrent rebuilds of the same file never share one; its
+//name goes into tempPath (TREASURE_TEMP_PATH_MAX bytes). Returns the fd,
+//open for writing, or -1.
+#define TREASURE_TEMP_PATH_MAX 120
+int createTempFile(const char* path, char* tempPath);
+
+//Encode a record into out (TREASURE_RECORD_MAX bytes), returns its length
+size_t encodeTreasure(const Treasure* treasure, unsigned char* out);
+
+//Decode the record at bytes. Returns its length, or 0 if the available
+//bytes do not hold a whole, well-formed record.
+size_t decodeTreasure(const unsigned char* bytes, size_t available, Treasure* treasure);
+
+#endif
@@ -0,0 +1,483 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "treasure.h"
+#include "treasure_columns.h"
+#include "treasure_reader.h"
+#include "score_table.h"
+
+//Rows staged per write, in per-thread buffers (hunts may be rebuilt from
+//several threads)
+#define COLUMN_CHUNK 4096
+
+//Column files, in the order of TreasureColumns.maps
+enum { COLUMN_USERS, COLUMN_UID, COLUMN_VALUE, COLUMN_LAT, COLUMN_LON, COLUMN_COUNT };
+
+static const char* columnNames[COLUMN_COUNT] = { "users", "uid", "value", "lat", "lon" };
+
+static void fillHeader(TreasureColumnsHeader* header, const struct stat* st,
+                       int rowCount, int userCount, int deletedCount)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, TREASURE_COLUMNS_MAGIC, 4);
+    header->version = TREASURE_COLUMNS_VERSION;
+    header->rowCount = rowCount;
+    header->userCount = userCount;
+    header->deletedCount = deletedCount;
+    header->dataSize = st->st_size;
+    header->dataMtimeSec = st->st_mtim.tv_sec;
+    header->dataMtimeNsec = st->st_mtim.tv_nsec;
+}
+
+//Check that a columns header describes the given treasures file
+static int headerMatches(const TreasureColumnsHeader* header, const struct stat* st)
+{
+    return memcmp(header->magic, TREASURE_COLUMNS_MAGIC, 4) == 0 &&
+           header->version == TREASURE_COLUMNS_VERSION &&
+           header->dataSize == st->st_size &&
+           header->dataMtimeSec == st->st_mtim.tv_sec &&
+           header->dataMtimeNsec == st->st_mtim.tv_nsec;
+}
+
+//Open the header file, returning its fd only if the header matches st
+static int openMatchingHeader(const char* huntId, const struct stat* st,
+                              int flags, TreasureColumnsHeader* header)
+{
+    char metaPath[100];
+    sprintf(metaPath, "./%s/columns.meta", huntId);
+
+    int metaFd = open(metaPath, flags);
+    if (metaFd == -1)
+    {
+        return -1;
+    }
+    if (pread(metaFd, header, sizeof(*header), 0) != sizeof(*header) ||
+        !headerMatches(header, st))
+    {
+        close(metaFd);
+        return -1;
+    }
+    return metaFd;
+}
+
+static void columnPath(char* path, const char* huntId, int column, const char* suffix)
+{
+    sprintf(path, "./%s/columns.%s%s", huntId, columnNames[column], suffix);
+}
+
+int rebuildTreasureColumns(const char* huntId)
+{
+    char filePath[100];
+    char path[100];
+    char tempPaths[COLUMN_COUNT][TREASURE_TEMP_PATH_MAX];
+    char tempPath[TREASURE_TEMP_PATH_MAX];
+    sprintf(filePath, "./%s/treasures", huntId);
+
+    TreasureReader reader;
+    if (openTreasureReader(&reader, filePath) == -1)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    fstat(reader.fd, &st);
+
+    int fds[COLUMN_COUNT];
+    int failed = 0;
+    for (int column = 0; column < COLUMN_COUNT; column++)
+    {
+        columnPath(path, huntId, column, "");
+        fds[column] = createTempFile(path, tempPaths[column]);
+        if (fds[column] == -1)
+        {
+            failed = 1;
+        }
+    }
+
+    //The dictionary hands out codes in first-seen order
+    ScoreTable dictionary;
+    initScoreTable(&dictionary);
+
+    static __thread uint32_t userIds[COLUMN_CHUNK];
+    static __thread int32_t values[COLUMN_CHUNK];
+    static __thread float latitudes[COLUMN_CHUNK];
+    static __thread float longitudes[COLUMN_CHUNK];
+    const Treasure* treasure;
+    int rowCount = 0;
+    int deletedCount = 0;
+    int pending = 0;
+
+    while (!failed && (treasure = nextTreasure(&reader)) != NULL)
+    {
+        if (TREASURE_IS_DELETED(treasure))
+        {
+            userIds[pending] = TREASURE_COLUMN_DELETED;
+            deletedCount++;
+        }
+        else
+        {
+            int code = internUserName(&dictionary, treasure->userName);
+            if (code == -1)
+            {
+                failed = 1;
+                break;
+            }
+            userIds[pending] = code;
+        }
+        values[pending] = treasure->value;
+        latitudes[pending] = treasure->latitude;
+        longitudes[pending] = treasure->longitude;
+
+        if (++pending == COLUMN_CHUNK)
+        {
+            write(fds[COLUMN_UID], userIds, sizeof(userIds));
+            write(fds[COLUMN_VALUE], values, sizeof(values));
+            write(fds[COLUMN_LAT], latitudes, sizeof(latitudes));
+            write(fds[COLUMN_LON], longitudes, sizeof(longitudes));
+            rowCount += pending;
+            pending = 0;
+        }
+    }
+    closeTreasureReader(&reader);
+
+    if (!failed)
+    {
+        write(fds[COLUMN_UID], userIds, pending * sizeof(uint32_t));
+        write(fds[COLUMN_VALUE], values, pending * sizeof(int32_t));
+        write(fds[COLUMN_LAT], latitudes, pending * sizeof(float));
+        write(fds[COLUMN_LON], longitudes, pending * sizeof(float));
+        rowCount += pending;
+
+        //Names are padded with NULs by the score table already
+        for (int user = 0; user < dictionary.userCount; user++)
+        {
+            write(fds[COLUMN_USERS], dictionary.users[user].userName, TREASURE_COLUMN_NAME);
+        }
+    }
+
+    TreasureColumnsHeader header;
+    fillHeader(&header, &st, rowCount, dictionary.userCount, deletedCount);
+    freeScoreTable(&dictionary);
+
+    for (int column = 0; column < COLUMN_COUNT; column++)
+    {
+        if (fds[column] == -1)
+        {
+            continue;
+        }
+        close(fds[column]);
+        columnPath(path, huntId, column, "");
+        if (failed || rename(tempPaths[column], path) == -1)
+        {
+            failed = 1;
+            unlink(tempPaths[column]);
+        }
+    }
+    if (failed)
+    {
+        perror("Failed to build treasure columns");
+        return -1;
+    }
+
+    //The header goes in last, so a half-replaced set of columns is never
+    //taken as matching the treasures file
+    sprintf(path, "./%s/columns.meta", huntId);
+    int metaFd = createTempFile(path, tempPath);
+    if (metaFd == -1 || write(metaFd, &header, sizeof(header)) != sizeof(header))
+    {
+        perror("Failed to write treasure columns header");
+        if (metaFd != -1)
+        {
+            close(metaFd);
+            unlink(tempPath);
+        }
+        return -1;
+    }
+    close(metaFd);
+
+    if (rename(tempPath, path) == -1)
+    {
+        perror("Failed to install treasure columns");
+        unlink(tempPath);
+        return -1;
+    }
+
+    return 0;
+}
+
+//Load the user dictionary of a hunt into a table, codes in file order
+static int loadDictionary(const char* huntId, int userCount, ScoreTable* dictionary)
+{
+    char path[100];
+    columnPath(path, huntId, COLUMN_USERS, "");
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    static __thread char names[COLUMN_CHUNK][TREASURE_COLUMN_NAME];
+    int loaded = 0;
+    while (loaded < userCount)
+    {
+        int wanted = userCount - loaded < COLUMN_CHUNK ? userCount - loaded : COLUMN_CHUNK;
+        ssize_t got = pread(fd, names, wanted * TREASURE_COLUMN_NAME,
+                            (off_t)loaded * TREASURE_COLUMN_NAME);
+        if (got != wanted * TREASURE_COLUMN_NAME)
+        {
+            close(fd);
+            return -1;
+        }
+        for (int i = 0; i < wanted; i++)
+        {
+            names[i][TREASURE_COLUMN_NAME - 1] = '\0';
+            if (internUserName(dictionary, names[i]) != loaded + i)
+            {
+                close(fd);
+                return -1;
+            }
+        }
+        loaded += wanted;
+    }
+    close(fd);
+
+    return 0;
+}
+
+static int writeColumn(const char* huntId, int column, const void* data, size_t length, off_t at)
+{
+    char path[100];
+    columnPath(path, huntId, column, "");
+
+    int fd = open(path, O_WRONLY);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    int result = pwrite(fd, data, length, at) == (ssize_t)length ? 0 : -1;
+    close(fd);
+    return result;
+}
+
+int appendTreasureColumns(const char* huntId, const struct stat* before,
+                          const Treasure* treasures, int count)
+{
+    char filePath[100];
+    sprintf(filePath, "./%s/treasures", huntId);
+
+    struct stat st;
+    if (stat(filePath, &st) == -1)
+    {
+        return -1;
+    }
+
+    TreasureColumnsHeader header;
+    int metaFd = openMatchingHeader(huntId, before, O_RDWR, &header);
+    if (metaFd == -1)
+    {
+        return rebuildTreasureColumns(huntId);
+    }
+
+    ScoreTable dictionary;
+    initScoreTable(&dictionary);
+    uint32_t* userIds = malloc(count * sizeof(uint32_t));
+    int32_t* values = malloc(count * sizeof(int32_t));
+    float* latitudes = malloc(count * sizeof(float));
+    float* longitudes = malloc(count * sizeof(float));
+    int failed = userIds == NULL || values == NULL || latitudes == NULL || longitudes == NULL ||
+                 loadDictionary(huntId, header.userCount, &dictionary) == -1;
+
+    int deletedCount = header.deletedCount;
+    for (int i = 0; i < count && !failed; i++)
+    {
+        if (TREASURE_IS_DELETED(&treasures[i]))
+        {
+            userIds[i] = TREASURE_COLUMN_DELETED;
+            deletedCount++;
+        }
+        else
+        {
+            int code = internUserName(&dictionary, treasures[i].userName);
+            failed = code == -1;
+            userIds[i] = code;
+        }
+        values[i] = treasures[i].value;
+        latitudes[i] = treasures[i].latitude;
+        longitudes[i] = treasures[i].longitude;
+    }
+
+    //Rows first, then any new names, then the header that makes them visible
+    off_t at = (off_t)header.rowCount * 4;
+    if (!failed)
+    {
+        failed = writeColumn(huntId, COLUMN_UID, userIds, count * sizeof(uint32_t), at) == -1 ||
+                 writeColumn(huntId, COLUMN_VALUE, values, count * sizeof(int32_t), at) == -1 ||
+                 writeColumn(huntId, COLUMN_LAT, latitudes, count * sizeof(float), at) == -1 ||
+                 writeColumn(huntId, COLUMN_LON, longitudes, count * sizeof(float), at) == -1;
+    }
+    for (int user = header.userCount; user < dictionary.userCount && !failed; user++)
+    {
+        failed = writeColumn(huntId, COLUMN_USERS, dictionary.users[user].userName,
+                             TREASURE_COLUMN_NAME, (off_t)user * TREASURE_COLUMN_NAME) == -1;
+    }
+    if (!failed)
+    {
+        fillHeader(&header, &st, header.rowCount + count, dictionary.userCount, deletedCount);
+        pwrite(metaFd, &header, sizeof(header), 0);
+    }
+    close(metaFd);
+
+    freeScoreTable(&dictionary);
+    free(userIds);
+    free(values);
+    free(latitudes);
+    free(longitudes);
+
+    return failed ? rebuildTreasureColumns(huntId) : 0;
+}
+
+int markTreasureColumnsDeleted(const char* huntId, const struct stat* before, int position)
+{
+    char filePath[100];
+    char uidPath[100];
+    sprintf(filePath, "./%s/treasures", huntId);
+    columnPath(uidPath, huntId, COLUMN_UID, "");
+
+    struct stat st;
+    if (stat(filePath, &st) == -1)
+    {
+        return -1;
+    }
+
+    TreasureColumnsHeader header;
+    int metaFd = openMatchingHeader(huntId, before, O_RDWR, &header);
+    int uidFd = metaFd == -1 ? -1 : open(uidPath, O_RDWR);
+    if (uidFd == -1 || position < 0 || position >= header.rowCount)
+    {
+        if (metaFd != -1)
+        {
+            close(metaFd);
+        }
+        if (uidFd != -1)
+        {
+            close(uidFd);
+        }
+        return rebuildTreasureColumns(huntId);
+    }
+
+    //Only the user code changes, the row keeps its place
+    uint32_t userId;
+    uint32_t deleted = TREASURE_COLUMN_DELETED;
+    off_t at = (off_t)position * sizeof(uint32_t);
+    int deletedCount = header.deletedCount;
+    if (pread(uidFd, &userId, sizeof(userId), at) == sizeof(userId) &&
+        userId != TREASURE_COLUMN_DELETED &&
+        pwrite(uidFd, &deleted, sizeof(deleted), at) == sizeof(deleted))
+    {
+        deletedCount++;
+    }
+    close(uidFd);
+
+    fillHeader(&header, &st, header.rowCount, header.userCount, deletedCount);
+    pwrite(metaFd, &header, sizeof(header), 0);
+    close(metaFd);
+
+    return 0;
+}
+
+int openTreasureColumns(TreasureColumns* columns, const char* huntId)
+{
+    char filePath[100];
+    char path[100];
+    sprintf(filePath, "./%s/treasures", huntId);
+    memset(columns, 0, sizeof(*columns));
+
+    struct stat st;
+    if (stat(filePath, &st) == -1)
+    {
+        return -1;
+    }
+
+    int metaFd = openMatchingHeader(huntId, &st, O_RDONLY, &columns->header);
+    if (metaFd == -1)
+    {
+        return -1;
+    }
+
+    for (int column = 0; column < COLUMN_COUNT; column++)
+    {
+        size_t length = column == COLUMN_USERS
+                        ? (size_t)columns->header.userCount * TREASURE_COLUMN_NAME
+                        : (size_t)columns->header.rowCount * 4;
+        if (length == 0)
+        {
+            continue;
+        }
+
+        columnPath(path, huntId, column, "");
+        int fd = open(path, O_RDONLY);
+        struct stat columnStat;
+        void* map = MAP_FAILED;
+        if (fd != -1 && fstat(fd, &columnStat) == 0 && columnStat.st_size >= (off_t)length)
+        {
+            map = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        if (map == MAP_FAILED)
+        {
+            close(metaFd);
+            closeTreasureColumns(columns);
+            return -1;
+        }
+        columns->maps[column] = map;
+        columns->mapLengths[column] = length;
+    }
+
+    //A rebuild may have swapped files while they were mapped; the header
+    //is replaced last, so an unchanged header means a consistent set
+    close(metaFd);
+    TreasureColumnsHeader check;
+    metaFd = openMatchingHeader(huntId, &st, O_RDONLY, &check);
+    int changed = metaFd == -1 || memcmp(&check, &columns->header, sizeof(check)) != 0;
+    if (metaFd != -1)
+    {
+        close(metaFd);
+    }
+    if (changed)
+    {
+        closeTreasureColumns(columns);
+        return -1;
+    }
+
+    columns->userNames = columns->maps[COLUMN_USERS];
+    columns->userIds = columns->maps[COLUMN_UID];
+    columns->values = columns->maps[COLUMN_VALUE];
+    columns->latitudes = columns->maps[COLUMN_LAT];
+    columns->longitudes = columns->maps[COLUMN_LON];
+    madvise(columns->maps[COLUMN_UID], columns->mapLengths[COLUMN_UID], MADV_SEQUENTIAL);
+    madvise(columns->maps[COLUMN_VALUE], columns->mapLengths[COLUMN_VALUE], MADV_SEQUENTIAL);
+
+    return 0;
+}
+
+void closeTreasureColumns(TreasureColumns* columns)
+{
+    for (int column = 0; column < COLUMN_COUNT; column++)
+    {
+        if (columns->maps[column] != NULL)
+        {
+            munmap(columns->maps[column], columns->mapLengths[column]);
+        }
+    }
+    memset(columns, 0, sizeof(*columns));
+}
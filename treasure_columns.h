@@ -0,0 +1,78 @@
+#ifndef TREASURE_COLUMNS_H
+#define TREASURE_COLUMNS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "treasure.h"
+
+#define TREASURE_COLUMNS_MAGIC "TCOL"
+#define TREASURE_COLUMNS_VERSION 1
+
+//User code stored for removed records
+#define TREASURE_COLUMN_DELETED UINT32_MAX
+
+//Length of one entry of the user dictionary
+#define TREASURE_COLUMN_NAME 50
+
+//Columnar copy of a hunt, one row per record in file order (the same
+//positions as the ID index). Each column is its own file of host-order
+//values so analytics can map just the columns they need:
+//
+//  columns.meta   this header
+//  columns.users  user dictionary, TREASURE_COLUMN_NAME bytes per user,
+//                 in first-seen order
+//  columns.uid    u32 dictionary code per row, TREASURE_COLUMN_DELETED
+//                 once the record is removed
+//  columns.value  i32 value per row
+//  columns.lat    f32 latitude per row
+//  columns.lon    f32 longitude per row
+//
+//Like the index, the header records the treasures file it was built from
+//and the columns are only trusted while that still matches.
+typedef struct {
+    char magic[4];
+    int version;
+    int rowCount;
+    int userCount;
+    int deletedCount;
+    int reserved;
+    long long dataSize;
+    long long dataMtimeSec;
+    long long dataMtimeNsec;
+} TreasureColumnsHeader;
+
+//Read-only view of the columns of a hunt
+typedef struct {
+    TreasureColumnsHeader header;
+    const char (*userNames)[TREASURE_COLUMN_NAME];
+    const uint32_t* userIds;
+    const int32_t* values;
+    const float* latitudes;
+    const float* longitudes;
+    void* maps[5];
+    size_t mapLengths[5];
+} TreasureColumns;
+
+//Rebuild every column of a hunt from its treasures file
+int rebuildTreasureColumns(const char* huntId);
+
+//Add rows for records just appended to the treasures file. "before" is the
+//state of the treasures file before the append; if the columns did not
+//match it, they are rebuilt instead.
+int appendTreasureColumns(const char* huntId, const struct stat* before,
+                          const Treasure* treasures, int count);
+
+//Clear the user code of the row at a position after its record was
+//tombstoned. "before" is the state of the treasures file before that write.
+int markTreasureColumnsDeleted(const char* huntId, const struct stat* before, int position);
+
+//Map the columns of a hunt. Returns 0 on success, -1 if they are missing
+//or do not describe the current treasures file (the caller should scan).
+int openTreasureColumns(TreasureColumns* columns, const char* huntId);
+
+void closeTreasureColumns(TreasureColumns* columns);
+
+#endif
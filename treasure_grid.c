@@ -0,0 +1,632 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "treasure.h"
+#include "treasure_grid.h"
+#include "treasure_reader.h"
+
+#define EARTH_RADIUS 6371000.0
+#define DEGREES_TO_RADIANS (M_PI / 180.0)
+
+//A treasure with the cell it falls in, sorted into cell order on rebuild
+typedef struct {
+    int cellLat;
+    int cellLon;
+    TreasureGridEntry entry;
+} GridItem;
+
+//Growing result array of a query
+typedef struct {
+    TreasureGridMatch* items;
+    int count;
+    int capacity;
+    int failed;
+} MatchList;
+
+//Cell of a coordinate. Values past a full turn, and NaN, are clamped so
+//the cell always fits an int; entries are still compared by coordinate.
+static int cellOf(double degrees)
+{
+    if (!(degrees > -360))
+    {
+        degrees = -360;
+    }
+    else if (degrees > 360)
+    {
+        degrees = 360;
+    }
+    return (int)floor(degrees / TREASURE_GRID_CELL);
+}
+
+static void fillHeader(TreasureGridHeader* header, const struct stat* st,
+                       int cellCount, int entryCount)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, TREASURE_GRID_MAGIC, 4);
+    header->version = TREASURE_GRID_VERSION;
+    header->cellCount = cellCount;
+    header->entryCount = entryCount;
+    header->cellDegrees = TREASURE_GRID_CELL;
+    header->dataSize = st->st_size;
+    header->dataMtimeSec = st->st_mtim.tv_sec;
+    header->dataMtimeNsec = st->st_mtim.tv_nsec;
+}
+
+//Check that a grid header describes the given treasures file
+static int headerMatches(const TreasureGridHeader* header, const struct stat* st)
+{
+    return memcmp(header->magic, TREASURE_GRID_MAGIC, 4) == 0 &&
+           header->version == TREASURE_GRID_VERSION &&
+           header->cellDegrees == TREASURE_GRID_CELL &&
+           header->dataSize == st->st_size &&
+           header->dataMtimeSec == st->st_mtim.tv_sec &&
+           header->dataMtimeNsec == st->st_mtim.tv_nsec;
+}
+
+static int compareItems(const void* a, const void* b)
+{
+    const GridItem* left = a;
+    const GridItem* right = b;
+    if (left->cellLat != right->cellLat)
+    {
+        return left->cellLat < right->cellLat ? -1 : 1;
+    }
+    if (left->cellLon != right->cellLon)
+    {
+        return left->cellLon < right->cellLon ? -1 : 1;
+    }
+    return (left->entry.treasureId > right->entry.treasureId) -
+           (left->entry.treasureId < right->entry.treasureId);
+}
+
+//Write a whole grid file and swap it in
+static int writeGrid(const char* huntId, const TreasureGridHeader* header,
+                     const TreasureGridCell* cells, const TreasureGridEntry* entries)
+{
+    char gridPath[100];
+    char tempPath[TREASURE_TEMP_PATH_MAX];
+    sprintf(gridPath, "./%s/treasures.grid", huntId);
+
+    //Queries rebuild a stale grid without the hunt lock, so each rebuild
+    //writes its own temp file
+    int gridFd = createTempFile(gridPath, tempPath);
+    size_t cellBytes = header->cellCount * sizeof(TreasureGridCell);
+    size_t entryBytes = header->entryCount * sizeof(TreasureGridEntry);
+    int failed = gridFd == -1 ||
+                 write(gridFd, header, sizeof(*header)) != sizeof(*header) ||
+                 write(gridFd, cells, cellBytes) != (ssize_t)cellBytes ||
+                 write(gridFd, entries, entryBytes) != (ssize_t)entryBytes;
+    if (gridFd != -1)
+    {
+        close(gridFd);
+    }
+
+    //Swap in atomically so concurrent queries never see a half-built grid
+    if (failed || rename(tempPath, gridPath) == -1)
+    {
+        perror("Failed to build treasure grid");
+        if (gridFd != -1)
+        {
+            unlink(tempPath);
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+int rebuildTreasureGrid(const char* huntId)
+{
+    char filePath[100];
+    sprintf(filePath, "./%s/treasures", huntId);
+
+    TreasureReader reader;
+    if (openTreasureReader(&reader, filePath) == -1)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    fstat(reader.fd, &st);
+
+    //Removed treasures are left out, a tombstone makes the grid stale anyway
+    GridItem* items = NULL;
+    int itemCount = 0;
+    int itemCapacity = 0;
+    const Treasure* treasure;
+    while ((treasure = nextTreasure(&reader)) != NULL)
+    {
+        if (TREASURE_IS_DELETED(treasure))
+        {
+            continue;
+        }
+        if (itemCount == itemCapacity)
+        {
+            int capacity = itemCapacity ? itemCapacity * 2 : 1024;
+            GridItem* grown = realloc(items, capacity * sizeof(GridItem));
+            if (grown == NULL)
+            {
+                free(items);
+                closeTreasureReader(&reader);
+                return -1;
+            }
+            items = grown;
+            itemCapacity = capacity;
+        }
+
+        GridItem* item = &items[itemCount++];
+        item->cellLat = cellOf(treasure->latitude);
+        item->cellLon = cellOf(treasure->longitude);
+        item->entry.treasureId = treasure->treasureId;
+        item->entry.latitude = treasure->latitude;
+        item->entry.longitude = treasure->longitude;
+        item->entry.deleted = 0;
+        item->entry.offset = reader.recordOffset;
+    }
+    closeTreasureReader(&reader);
+
+    qsort(items, itemCount, sizeof(GridItem), compareItems);
+
+    //Split the sorted items into the cell table and the entry array
+    TreasureGridCell* cells = malloc((itemCount + 1) * sizeof(TreasureGridCell));
+    TreasureGridEntry* entries = malloc((itemCount + 1) * sizeof(TreasureGridEntry));
+    if (cells == NULL || entries == NULL)
+    {
+        free(items);
+        free(cells);
+        free(entries);
+        return -1;
+    }
+
+    int cellCount = 0;
+    for (int i = 0; i < itemCount; i++)
+    {
+        if (i == 0 || items[i].cellLat != items[i - 1].cellLat ||
+            items[i].cellLon != items[i - 1].cellLon)
+        {
+            cells[cellCount].cellLat = items[i].cellLat;
+            cells[cellCount].cellLon = items[i].cellLon;
+            cells[cellCount].first = i;
+            cells[cellCount].count = 0;
+            cellCount++;
+        }
+        cells[cellCount - 1].count++;
+        entries[i] = items[i].entry;
+    }
+    free(items);
+
+    TreasureGridHeader header;
+    fillHeader(&header, &st, cellCount, itemCount);
+    int result = writeGrid(huntId, &header, cells, entries);
+    free(cells);
+    free(entries);
+    return result;
+}
+
+//Map an open grid file if it describes the treasures file state st
+static const TreasureGridHeader* mapMatchingGrid(int gridFd, const struct stat* st, size_t* length)
+{
+    struct stat gridStat;
+    void* map = MAP_FAILED;
+    if (gridFd != -1 && fstat(gridFd, &gridStat) == 0 &&
+        gridStat.st_size >= (off_t)sizeof(TreasureGridHeader))
+    {
+        map = mmap(NULL, gridStat.st_size, PROT_READ, MAP_SHARED, gridFd, 0);
+    }
+    if (map == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    const TreasureGridHeader* header = map;
+    size_t expected = sizeof(TreasureGridHeader) +
+                      (size_t)header->cellCount * sizeof(TreasureGridCell) +
+                      (size_t)header->entryCount * sizeof(TreasureGridEntry);
+    if (!headerMatches(header, st) || expected != (size_t)gridStat.st_size)
+    {
+        munmap(map, gridStat.st_size);
+        return NULL;
+    }
+    *length = gridStat.st_size;
+    return header;
+}
+
+//Map the grid of a hunt, rebuilding it first if it is missing or stale
+static const TreasureGridHeader* mapFreshGrid(const char* huntId, size_t* length)
+{
+    char filePath[100];
+    char gridPath[100];
+    sprintf(filePath, "./%s/treasures", huntId);
+    sprintf(gridPath, "./%s/treasures.grid", huntId);
+
+    struct stat st;
+    if (stat(filePath, &st) == -1)
+    {
+        return NULL;
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        int gridFd = open(gridPath, O_RDONLY);
+        const TreasureGridHeader* header = mapMatchingGrid(gridFd, &st, length);
+        if (gridFd != -1)
+        {
+            close(gridFd);
+        }
+        if (header != NULL)
+        {
+            return header;
+        }
+        if (rebuildTreasureGrid(huntId) == -1 || stat(filePath, &st) == -1)
+        {
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+//Order of two cells, as in the file
+static int compareCells(int latA, int lonA, int latB, int lonB)
+{
+    if (latA != latB)
+    {
+        return latA < latB ? -1 : 1;
+    }
+    return (lonA > lonB) - (lonA < lonB);
+}
+
+int appendTreasureGrid(const char* huntId, const struct stat* before,
+                       const TreasureGridEntry* added, int count)
+{
+    char filePath[100];
+    char gridPath[100];
+    sprintf(filePath, "./%s/treasures", huntId);
+    sprintf(gridPath, "./%s/treasures.grid", huntId);
+
+    struct stat st;
+    size_t length;
+    int gridFd = open(gridPath, O_RDONLY);
+    const TreasureGridHeader* header = mapMatchingGrid(gridFd, before, &length);
+    if (gridFd != -1)
+    {
+        close(gridFd);
+    }
+    if (header == NULL || stat(filePath, &st) == -1)
+    {
+        if (header != NULL)
+        {
+            munmap((void*)header, length);
+        }
+        return rebuildTreasureGrid(huntId);
+    }
+    const TreasureGridCell* oldCells = (const TreasureGridCell*)(header + 1);
+    const TreasureGridEntry* oldEntries = (const TreasureGridEntry*)(oldCells + header->cellCount);
+
+    //New IDs are above every ID in the grid, so the new entries of a cell
+    //go after its old ones
+    GridItem* items = malloc((count + 1) * sizeof(GridItem));
+    TreasureGridCell* cells = malloc((header->cellCount + count + 1) * sizeof(TreasureGridCell));
+    TreasureGridEntry* entries = malloc((header->entryCount + count + 1) * sizeof(TreasureGridEntry));
+    if (items == NULL || cells == NULL || entries == NULL)
+    {
+        free(items);
+        free(cells);
+        free(entries);
+        munmap((void*)header, length);
+        return rebuildTreasureGrid(huntId);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        items[i].cellLat = cellOf(added[i].latitude);
+        items[i].cellLon = cellOf(added[i].longitude);
+        items[i].entry = added[i];
+        items[i].entry.deleted = 0;
+    }
+    qsort(items, count, sizeof(GridItem), compareItems);
+
+    //Merge the old cells with the new items, both in cell order
+    int cellCount = 0;
+    int entryCount = 0;
+    int oldCell = 0;
+    int item = 0;
+    while (oldCell < header->cellCount || item < count)
+    {
+        int order = oldCell == header->cellCount ? 1 : item == count ? -1 :
+                    compareCells(oldCells[oldCell].cellLat, oldCells[oldCell].cellLon,
+                                 items[item].cellLat, items[item].cellLon);
+        TreasureGridCell* cell = &cells[cellCount++];
+        cell->cellLat = order <= 0 ? oldCells[oldCell].cellLat : items[item].cellLat;
+        cell->cellLon = order <= 0 ? oldCells[oldCell].cellLon : items[item].cellLon;
+        cell->first = entryCount;
+        if (order <= 0)
+        {
+            memcpy(entries + entryCount, oldEntries + oldCells[oldCell].first,
+                   oldCells[oldCell].count * sizeof(TreasureGridEntry));
+            entryCount += oldCells[oldCell].count;
+            oldCell++;
+        }
+        while (item < count && items[item].cellLat == cell->cellLat &&
+               items[item].cellLon == cell->cellLon)
+        {
+            entries[entryCount++] = items[item++].entry;
+        }
+        cell->count = entryCount - cell->first;
+    }
+    munmap((void*)header, length);
+    free(items);
+
+    TreasureGridHeader newHeader;
+    fillHeader(&newHeader, &st, cellCount, entryCount);
+    int result = writeGrid(huntId, &newHeader, cells, entries);
+    free(cells);
+    free(entries);
+    return result == -1 ? rebuildTreasureGrid(huntId) : 0;
+}
+
+int markTreasureGridDeleted(const char* huntId, const struct stat* before, int treasureId,
+                            double latitude, double longitude)
+{
+    char filePath[100];
+    char gridPath[100];
+    sprintf(filePath, "./%s/treasures", huntId);
+    sprintf(gridPath, "./%s/treasures.grid", huntId);
+
+    //Everything goes through one descriptor: a query may swap in a grid it
+    //rebuilt meanwhile, and the flag must not land in that one
+    struct stat st;
+    size_t length;
+    int gridFd = open(gridPath, O_RDWR);
+    const TreasureGridHeader* header = mapMatchingGrid(gridFd, before, &length);
+    if (header == NULL || stat(filePath, &st) == -1)
+    {
+        if (header != NULL)
+        {
+            munmap((void*)header, length);
+        }
+        if (gridFd != -1)
+        {
+            close(gridFd);
+        }
+        return rebuildTreasureGrid(huntId);
+    }
+    const TreasureGridCell* cells = (const TreasureGridCell*)(header + 1);
+    const TreasureGridEntry* entries = (const TreasureGridEntry*)(cells + header->cellCount);
+
+    //Find the treasure's cell, then the treasure in it
+    int cellLat = cellOf(latitude);
+    int cellLon = cellOf(longitude);
+    int low = 0;
+    int high = header->cellCount;
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+        if (compareCells(cells[mid].cellLat, cells[mid].cellLon, cellLat, cellLon) < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    off_t at = -1;
+    if (low < header->cellCount && cells[low].cellLat == cellLat && cells[low].cellLon == cellLon)
+    {
+        for (int e = cells[low].first; e < cells[low].first + cells[low].count; e++)
+        {
+            if (entries[e].treasureId == treasureId)
+            {
+                at = (const char*)&entries[e].deleted - (const char*)header;
+            }
+        }
+    }
+    TreasureGridHeader newHeader = *header;
+    munmap((void*)header, length);
+
+    //Only the flag changes, then the header that makes the grid current
+    int deleted = 1;
+    int failed = at == -1 || pwrite(gridFd, &deleted, sizeof(deleted), at) != sizeof(deleted);
+    if (!failed)
+    {
+        fillHeader(&newHeader, &st, newHeader.cellCount, newHeader.entryCount);
+        failed = pwrite(gridFd, &newHeader, sizeof(newHeader), 0) != sizeof(newHeader);
+    }
+    close(gridFd);
+
+    return failed ? rebuildTreasureGrid(huntId) : 0;
+}
+
+static void addMatch(MatchList* list, const TreasureGridEntry* entry, double distance)
+{
+    if (list->count == list->capacity)
+    {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        TreasureGridMatch* items = realloc(list->items, capacity * sizeof(TreasureGridMatch));
+        if (items == NULL)
+        {
+            list->failed = 1;
+            return;
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count].entry = *entry;
+    list->items[list->count].distance = distance;
+    list->count++;
+}
+
+//Walk the cells overlapping a box (no longitude wrap-around) and collect
+//the entries inside it. With a radius, entries must also lie within that
+//many metres of the centre.
+static void scanBox(const TreasureGridHeader* header, double minLat, double minLon,
+                    double maxLat, double maxLon, double centreLat, double centreLon,
+                    double radius, MatchList* list)
+{
+    const TreasureGridCell* cells = (const TreasureGridCell*)(header + 1);
+    const TreasureGridEntry* entries = (const TreasureGridEntry*)(cells + header->cellCount);
+    int lastCellLat = cellOf(maxLat);
+    int firstCellLon = cellOf(minLon);
+    int lastCellLon = cellOf(maxLon);
+
+    for (int cellLat = cellOf(minLat); cellLat <= lastCellLat; cellLat++)
+    {
+        //First cell at or after (cellLat, firstCellLon)
+        int low = 0;
+        int high = header->cellCount;
+        while (low < high)
+        {
+            int mid = low + (high - low) / 2;
+            if (cells[mid].cellLat < cellLat ||
+                (cells[mid].cellLat == cellLat && cells[mid].cellLon < firstCellLon))
+            {
+                low = mid + 1;
+            }
+            else
+            {
+                high = mid;
+            }
+        }
+
+        for (int c = low; c < header->cellCount && cells[c].cellLat == cellLat &&
+                          cells[c].cellLon <= lastCellLon; c++)
+        {
+            for (int e = cells[c].first; e < cells[c].first + cells[c].count; e++)
+            {
+                const TreasureGridEntry* entry = &entries[e];
+                if (entry->deleted || entry->latitude < minLat || entry->latitude > maxLat ||
+                    entry->longitude < minLon || entry->longitude > maxLon)
+                {
+                    continue;
+                }
+
+                double distance = 0;
+                if (radius >= 0)
+                {
+                    distance = treasureDistance(centreLat, centreLon, entry->latitude, entry->longitude);
+                    if (distance > radius)
+                    {
+                        continue;
+                    }
+                }
+                addMatch(list, entry, distance);
+            }
+        }
+    }
+}
+
+static int compareById(const void* a, const void* b)
+{
+    const TreasureGridMatch* left = a;
+    const TreasureGridMatch* right = b;
+    return (left->entry.treasureId > right->entry.treasureId) -
+           (left->entry.treasureId < right->entry.treasureId);
+}
+
+static int compareByDistance(const void* a, const void* b)
+{
+    const TreasureGridMatch* left = a;
+    const TreasureGridMatch* right = b;
+    if (left->distance != right->distance)
+    {
+        return left->distance < right->distance ? -1 : 1;
+    }
+    return compareById(a, b);
+}
+
+//Run a query over the grid, handing back the sorted matches
+static int runQuery(const char* huntId, double minLat, double minLon, double maxLat,
+                    double maxLon, double centreLat, double centreLon, double radius,
+                    TreasureGridMatch** matches)
+{
+    size_t length;
+    const TreasureGridHeader* header = mapFreshGrid(huntId, &length);
+    if (header == NULL)
+    {
+        return -1;
+    }
+
+    MatchList list = { NULL, 0, 0, 0 };
+
+    //A box running past the date line is scanned as two boxes
+    if (maxLon - minLon >= 360)
+    {
+        scanBox(header, minLat, -180, maxLat, 180, centreLat, centreLon, radius, &list);
+    }
+    else if (minLon < -180)
+    {
+        scanBox(header, minLat, minLon + 360, maxLat, 180, centreLat, centreLon, radius, &list);
+        scanBox(header, minLat, -180, maxLat, maxLon, centreLat, centreLon, radius, &list);
+    }
+    else if (maxLon > 180)
+    {
+        scanBox(header, minLat, minLon, maxLat, 180, centreLat, centreLon, radius, &list);
+        scanBox(header, minLat, -180, maxLat, maxLon - 360, centreLat, centreLon, radius, &list);
+    }
+    else
+    {
+        scanBox(header, minLat, minLon, maxLat, maxLon, centreLat, centreLon, radius, &list);
+    }
+    munmap((void*)header, length);
+
+    if (list.failed)
+    {
+        free(list.items);
+        return -1;
+    }
+
+    qsort(list.items, list.count, sizeof(TreasureGridMatch),
+          radius >= 0 ? compareByDistance : compareById);
+    *matches = list.items;
+    return list.count;
+}
+
+int findTreasuresInBox(const char* huntId, double minLat, double minLon,
+                       double maxLat, double maxLon, TreasureGridMatch** matches)
+{
+    return runQuery(huntId, minLat, minLon, maxLat, maxLon, 0, 0, -1, matches);
+}
+
+int findTreasuresNear(const char* huntId, double latitude, double longitude,
+                      double radius, TreasureGridMatch** matches)
+{
+    //Box around the circle: a degree of latitude is always the same length,
+    //a degree of longitude shrinks towards the poles
+    double latSpan = radius / (EARTH_RADIUS * DEGREES_TO_RADIANS);
+    double minLat = latitude - latSpan;
+    double maxLat = latitude + latSpan;
+    double minLon = -180;
+    double maxLon = 180;
+
+    double widest = fmax(fabs(minLat), fabs(maxLat));
+    if (widest < 90)
+    {
+        double lonSpan = latSpan / cos(widest * DEGREES_TO_RADIANS);
+        if (lonSpan < 180)
+        {
+            minLon = longitude - lonSpan;
+            maxLon = longitude + lonSpan;
+        }
+    }
+
+    return runQuery(huntId, minLat, minLon, maxLat, maxLon, latitude, longitude, radius, matches);
+}
+
+double treasureDistance(double lat1, double lon1, double lat2, double lon2)
+{
+    double phi1 = lat1 * DEGREES_TO_RADIANS;
+    double phi2 = lat2 * DEGREES_TO_RADIANS;
+    double dPhi = phi2 - phi1;
+    double dLambda = (lon2 - lon1) * DEGREES_TO_RADIANS;
+
+    double a = sin(dPhi / 2) * sin(dPhi / 2) +
+               cos(phi1) * cos(phi2) * sin(dLambda / 2) * sin(dLambda / 2);
+    return 2 * EARTH_RADIUS * asin(fmin(1.0, sqrt(a)));
+}
@@ -0,0 +1,77 @@
+#ifndef TREASURE_GRID_H
+#define TREASURE_GRID_H
+
+#include <sys/stat.h>
+
+#define TREASURE_GRID_MAGIC "TGRD"
+#define TREASURE_GRID_VERSION 1
+
+//Side of a grid cell in degrees, about 1.1 km of latitude
+#define TREASURE_GRID_CELL 0.01
+
+//Spatial index of a hunt (<hunt>/treasures.grid): live treasures bucketed
+//into a uniform latitude/longitude grid. The file holds this header, then
+//the non-empty cells sorted by (cellLat, cellLon), then the entries of
+//every cell in cell order, by ID within a cell. As with the ID index, the
+//header describes the treasures file it was built from; writers keep it in
+//step, and a stale grid is rebuilt on the next query.
+typedef struct {
+    char magic[4];
+    int version;
+    int cellCount;
+    int entryCount;
+    double cellDegrees;
+    long long dataSize;
+    long long dataMtimeSec;
+    long long dataMtimeNsec;
+} TreasureGridHeader;
+
+typedef struct {
+    int cellLat;  //floor(latitude / cellDegrees)
+    int cellLon;  //floor(longitude / cellDegrees)
+    int first;  //first entry of the cell
+    int count;
+} TreasureGridCell;
+
+typedef struct {
+    int treasureId;
+    float latitude;
+    float longitude;
+    int deleted;  //set when the treasure is removed, until the next rebuild
+    long long offset;  //record offset in the treasures file
+} TreasureGridEntry;
+
+//One query hit, distance in metres from the query point (0 for boxes)
+typedef struct {
+    TreasureGridEntry entry;
+    double distance;
+} TreasureGridMatch;
+
+//Rebuild the grid of a hunt from its treasures file
+int rebuildTreasureGrid(const char* huntId);
+
+//File treasures just appended to the treasures file into their cells.
+//"before" is the state of the treasures file before the append; if the
+//grid did not match it, it is rebuilt instead.
+int appendTreasureGrid(const char* huntId, const struct stat* before,
+                       const TreasureGridEntry* entries, int count);
+
+//Mark the entry of a treasure that was tombstoned in place. "before" is
+//the state of the treasures file before that write.
+int markTreasureGridDeleted(const char* huntId, const struct stat* before, int treasureId,
+                            double latitude, double longitude);
+
+//Treasures inside a latitude/longitude box, in ID order. On success
+//*matches is a malloc'd array the caller frees and the count is returned;
+//-1 on error.
+int findTreasuresInBox(const char* huntId, double minLat, double minLon,
+                       double maxLat, double maxLon, TreasureGridMatch** matches);
+
+//Treasures within radius metres of a point, nearest first
+int findTreasuresNear(const char* huntId, double latitude, double longitude,
+                      double radius, TreasureGridMatch** matches);
+
+//Great-circle distance in metres
+double treasureDistance(double lat1, double lon1, double lat2, double lon2);
+
+#endif
@@ -1,4 +1,7 @@
+// fopencookie() for the monitor's result streams
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -8,20 +11,67 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "treasure.h"
+#include "treasure_index.h"
+#include "treasure_reader.h"
+#include "treasure_query.h"
+#include "treasure_grid.h"
+#include "hunt_catalog.h"
+#include "score_pool.h"
+#include "treasure_stats.h"
 
 // Global variables
 pid_t monitor_pid = -1;  // Process ID of the monitor
 int is_monitor_stopping = 0;  // Flag to check if monitor is stopping
-char command_file[] = "command.txt";  // File for communication
+int command_fd = -1;  // Hub end of the command channel
+unsigned int next_request_id = 1;  // ID given to the next command sent
+FILE* batch_input = NULL;  // Command file of batch mode, stdin interactively
+
+// Hub side of the result pipe. A render thread copies each result frame to
+// result_output (stdout unless redirected) while the prompt stays usable.
+int result_fd = -1;
+pthread_t render_thread;
+int render_running = 0;
+pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+FILE* result_output = NULL;
 
+// Per-command latency, from sending a command to its result being rendered
+pthread_mutex_t request_lock = PTHREAD_MUTEX_INITIALIZER;
+struct timespec* sent_times = NULL;  // indexed by request ID
+size_t sent_capacity = 0;
+double* latencies = NULL;  // milliseconds, in the order results arrived
+size_t latency_count = 0;
+size_t latency_capacity = 0;
+
+// Header of one frame on the hub -> monitor command channel.
+// It is followed by length bytes of "command [params...]" text.
+// Frames on the monitor -> hub result pipe use the same header, followed
+// by up to RESULT_CHUNK bytes of what the command printed so far;
+// request_id names the command and an empty frame ends its result.
 typedef struct {
-    int treasureId;
-    char userName[50];
-    float latitude;
-    float longitude;
-    char clueText[200];
-    int value;
-} Treasure;
+    unsigned int length;
+    unsigned int request_id;
+} CommandFrame;
+
+#define MAX_COMMAND_PAYLOAD 256
+#define RESULT_CHUNK 65536
+
+// Monitor side of the command channel and of the result pipe
+int monitor_command_fd = -1;
+int monitor_result_fd = -1;
+int stop_requested = 0;  // stop_monitor ran, exit once its result is sent
+HuntCatalog catalog;  // Hunts known to the monitor, kept fresh by inotify
+ScorePool score_pool;  // Score workers, forked once when the monitor starts
+char pending_frames[4096];  // Bytes received but not yet executed
+size_t pending_length = 0;
 
 void handle_child_termination(int signo) 
 {
@@ -81,108 +131,102 @@ void print_directory_contents(const char* dir_name)
     closedir(dir);
 }
 
-// Handler for command signals in monitor process
-void handle_command_signal(int signo) 
+// Where a calculate_score command collects the pool's reports
+typedef struct {
+    FILE* out;
+    int hunts_scored;
+    int hunts_failed;
+} ScoreOutput;
+
+// Print one hunt's score report as the pool hands it over
+void print_score_report(const char* report, size_t length, int failed, void* context) 
 {
-    // Open and read the command file
-    FILE *cmdFile = fopen(command_file, "r");
-    if (cmdFile == NULL) 
+    ScoreOutput* output = context;
+    fwrite(report, 1, length, output->out);
+    if (failed) 
     {
-        perror("Monitor: Failed to open command file");
-        return;
+        output->hunts_failed++;
     }
-    
-    // Read command and parameter
+    else 
+    {
+        output->hunts_scored++;
+    }
+}
+
+// Stop the score workers when the monitor exits, whichever way it does
+void stop_score_pool() 
+{
+    score_pool_stop(&score_pool);
+}
+
+// Run one command received from the hub, printing its result to out
+void execute_command(FILE* out, unsigned int request_id, const char* payload) 
+{
+    // Read command and parameters
     char cmd[50] = {0};
     char param[100] = {0};
-    fscanf(cmdFile, "%s %s", cmd, param);
-    fclose(cmdFile);
+    int treasureId = 0;
+    sscanf(payload, "%49s %99s %d", cmd, param, &treasureId);
     
     // Process different commands
     if (strcmp(cmd, "list_hunts") == 0) 
     {
-        printf("\n--- MONITOR: LISTING ALL HUNTS ---\n");
+        fprintf(out, "\n--- MONITOR: LISTING ALL HUNTS (request %u) ---\n", request_id);
         
-        // Open current directory
-        DIR *dir = opendir(".");
-        if (dir == NULL) 
-        {
-            perror("Monitor: Failed to open directory");
-            return;
-        }
+        // Answer from the in-memory catalog, only changed hunts get rescanned
+        catalog_refresh(&catalog);
         
-        struct dirent *entry;
         int huntCount = 0;
-        
-        // Debug: Print all directory entries
-        printf("Current directory contents:\n");
-        while ((entry = readdir(dir)) != NULL)
+        for (int i = 0; i < catalog.count; i++) 
         {
-            printf("  %s", entry->d_name);
-            
-            // Skip . and .. directories
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) 
+            HuntEntry *hunt = &catalog.hunts[i];
+            if (!hunt->is_hunt) 
             {
-                printf(" (skipped)\n");
                 continue;
             }
             
-            struct stat st;
-            if (stat(entry->d_name, &st) == 0) 
-            {
-                if (S_ISDIR(st.st_mode)) 
-                {
-                    printf(" (directory)");
-                    
-                    // Check if this directory has a treasures file
-                    char treasureFile[150];
-                    sprintf(treasureFile, "%s/treasures", entry->d_name);
-                    
-                    struct stat treasure_st;
-                    if (stat(treasureFile, &treasure_st) == 0) 
-                    {
-                        // Count treasures based on file size and struct size
-                        int treasureCount = treasure_st.st_size / sizeof(Treasure);
-                        printf(" - Hunt with %d treasures\n", treasureCount);
-                        
-                        // Print actual hunt information
-                        printf("Hunt: %s - Total treasures: %d\n", entry->d_name, treasureCount);
-                        huntCount++;
-                    } 
-                    else 
-                    {
-                        printf(" - Not a hunt (no treasures file)\n");
-                    }
-                } 
-                else 
-                {
-                    printf(" (file)\n");
-                }
-            } 
-            else 
-            {
-                printf(" (cannot stat)\n");
-            }
+            char modified[64];
+            strftime(modified, sizeof(modified), "%Y-%m-%d %H:%M:%S", localtime(&hunt->mtime));
+            fprintf(out, "Hunt: %s - Total treasures: %d, total value: %lld, size: %lld bytes, modified: %s\n",
+                    hunt->name, hunt->treasure_count, hunt->total_value, hunt->size, modified);
+            huntCount++;
         }
         
         if (huntCount == 0) 
         {
-            printf("No hunts found.\n");
+            fprintf(out, "No hunts found.\n");
         }
         
-        closedir(dir);
-        printf("--- END OF HUNT LISTING ---\n\n");
+        fprintf(out, "--- END OF HUNT LISTING ---\n\n");
         
     } 
     else if (strcmp(cmd, "list_treasures") == 0) 
     {
-        printf("\n--- MONITOR: LISTING TREASURES FOR HUNT: %s ---\n", param);
+        // Anything after the hunt ID is listing options
+        int optionsAt = 0;
+        sscanf(payload, "%*s %*s %n", &optionsAt);
+        TreasureQuery query;
+        initTreasureQuery(&query);
+        int parsed = optionsAt > 0 ? parseTreasureQueryText(&query, payload + optionsAt) : 0;
+        
+        // Machine-readable output carries only the data, so the banner is
+        // left out there; otherwise it goes out ahead of the listing
+        if (parsed == -1 || query.format == OUTPUT_TEXT) 
+        {
+            fprintf(out, "\n--- MONITOR: LISTING TREASURES FOR HUNT: %s (request %u) ---\n", param, request_id);
+            fflush(out);
+        }
+        if (parsed == -1) 
+        {
+            fprintf(out, "Error: Unknown list_treasures option in '%s'\n", payload + optionsAt);
+            return;
+        }
         
         // Check if hunt directory exists
         struct stat st;
         if (stat(param, &st) == -1 || !S_ISDIR(st.st_mode)) 
         {
-            printf("Error: Hunt '%s' not found or not a directory\n", param);
+            fprintf(out, "Error: Hunt '%s' not found or not a directory\n", param);
             return;
         }
         
@@ -192,56 +236,48 @@ void handle_command_signal(int signo)
         
         if (stat(treasureFile, &st) == -1) 
         {
-            printf("Error: No treasures file found for hunt '%s'\n", param);
+            fprintf(out, "Error: No treasures file found for hunt '%s'\n", param);
             return;
         }
         
-        // Open treasures file directly
-        int fd = open(treasureFile, O_RDONLY);
-        if (fd == -1) 
+        // Map treasures file
+        TreasureReader reader;
+        if (openTreasureReader(&reader, treasureFile) == -1) 
         {
-            perror("Failed to open treasures file");
+            fprintf(out, "Failed to open treasures file: %s\n", strerror(errno));
             return;
         }
         
-        // Print hunt info
-        printf("Hunt: %s\n", param);
-        printf("File size: %lld bytes\n", st.st_size);
-        
-        // Read and print all treasures
-        Treasure treasure;
-        printf("Treasures in hunt %s:\n", param);
-        printf("-------------------\n");
-        
-        int treasureCount = 0;
-        while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure)) 
+        // Print hunt info, again only for text output
+        int text = query.format == OUTPUT_TEXT;
+        if (text) 
         {
-            printf("ID: %d\n", treasure.treasureId);
-            printf("User: %s\n", treasure.userName);
-            printf("Location: %.6f, %.6f\n", treasure.latitude, treasure.longitude);
-            printf("Clue: %s\n", treasure.clueText);
-            printf("Value: %d\n", treasure.value);
-            printf("-------------------\n");
-            treasureCount++;
+            fprintf(out, "Hunt: %s\n", param);
+            fprintf(out, "File size: %lld bytes\n", (long long)st.st_size);
+            fprintf(out, "Treasures in hunt %s:\n", param);
+            fprintf(out, "-------------------\n");
         }
         
-        if (treasureCount == 0) 
+        // Read and print the matching treasures
+        long treasureCount = printTreasureQuery(out, &reader, param, &query);
+        
+        if (treasureCount == 0 && text) 
         {
-            printf("No treasures found in this hunt.\n");
+            fprintf(out, "No treasures found in this hunt.\n");
         }
         
-        close(fd);
+        closeTreasureReader(&reader);
         
     } 
     else if (strcmp(cmd, "view_treasure") == 0) 
     {
-        printf("\n--- MONITOR: VIEWING TREASURE IN HUNT: %s ---\n", param);
+        fprintf(out, "\n--- MONITOR: VIEWING TREASURE IN HUNT: %s (request %u) ---\n", param, request_id);
         
         // Check if hunt directory exists
         struct stat st;
         if (stat(param, &st) == -1 || !S_ISDIR(st.st_mode)) 
         {
-            printf("Error: Hunt '%s' not found or not a directory\n", param);
+            fprintf(out, "Error: Hunt '%s' not found or not a directory\n", param);
             return;
         }
         
@@ -251,62 +287,581 @@ void handle_command_signal(int signo)
         
         if (stat(treasureFile, &st) == -1) 
         {
-            printf("Error: No treasures file found for hunt '%s'\n", param);
+            fprintf(out, "Error: No treasures file found for hunt '%s'\n", param);
             return;
         }
         
-        // Open treasures file directly
-        int fd = open(treasureFile, O_RDONLY);
-        if (fd == -1) 
+        // Map treasures file
+        TreasureReader reader;
+        if (openTreasureReader(&reader, treasureFile) == -1) 
         {
-            perror("Failed to open treasures file");
+            fprintf(out, "Failed to open treasures file: %s\n", strerror(errno));
             return;
         }
         
-        // Ask for treasure ID
-        int treasureId;
-        printf("Enter treasure ID to view: ");
-        scanf("%d", &treasureId);
-        
-        // Find and display the treasure
-        Treasure treasure;
+        // Seek straight to the treasure using the ID index
+        const Treasure* treasure;
         int found = 0;
+        off_t offset;
         
-        while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure)) 
+        if (findTreasureOffset(param, treasureId, &offset) == 1 &&
+            (treasure = treasureAt(&reader, offset)) != NULL) 
         {
-            if (treasure.treasureId == treasureId) 
+            if (treasure->treasureId == treasureId) 
             {
-                printf("\nTreasure Details:\n");
-                printf("ID: %d\n", treasure.treasureId);
-                printf("User: %s\n", treasure.userName);
-                printf("Location: %.6f, %.6f\n", treasure.latitude, treasure.longitude);
-                printf("Clue: %s\n", treasure.clueText);
-                printf("Value: %d\n", treasure.value);
+                fprintf(out, "\nTreasure Details:\n");
+                fprintf(out, "ID: %d\n", treasure->treasureId);
+                fprintf(out, "User: %s\n", treasure->userName);
+                fprintf(out, "Location: %.6f, %.6f\n", treasure->latitude, treasure->longitude);
+                fprintf(out, "Clue: %s\n", treasure->clueText);
+                fprintf(out, "Value: %d\n", treasure->value);
                 found = 1;
-                break;
             }
         }
         
         if (!found) 
         {
-            printf("Treasure with ID %d not found in hunt %s\n", treasureId, param);
+            fprintf(out, "Treasure with ID %d not found in hunt %s\n", treasureId, param);
         }
         
-        close(fd);
+        closeTreasureReader(&reader);
         
-    } else if (strcmp(cmd, "stop_monitor") == 0) 
+    } 
+    else if (strcmp(cmd, "near") == 0) 
     {
-        printf("\n--- MONITOR: STOPPING ---\n");
-        printf("Monitor process (PID: %d) is shutting down...\n", getpid());
+        fprintf(out, "\n--- MONITOR: TREASURES NEAR A POINT IN HUNT: %s (request %u) ---\n", param, request_id);
+        
+        double latitude, longitude, radius;
+        if (sscanf(payload, "%*s %*s %lf %lf %lf", &latitude, &longitude, &radius) != 3) 
+        {
+            fprintf(out, "Error: near needs a latitude, a longitude and a radius\n");
+            return;
+        }
+        
+        // The spatial grid narrows the search to the cells around the point
+        TreasureGridMatch* matches;
+        int count = findTreasuresNear(param, latitude, longitude, radius, &matches);
+        if (count == -1) 
+        {
+            fprintf(out, "Error: No treasures file found for hunt '%s'\n", param);
+            return;
+        }
+        
+        char treasureFile[150];
+        sprintf(treasureFile, "%s/treasures", param);
+        TreasureReader reader;
+        if (openTreasureReader(&reader, treasureFile) == -1) 
+        {
+            fprintf(out, "Failed to open treasures file: %s\n", strerror(errno));
+            free(matches);
+            return;
+        }
+        
+        fprintf(out, "Within %.0f m of %.6f, %.6f:\n", radius, latitude, longitude);
+        fprintf(out, "-------------------\n");
+        
+        int shown = 0;
+        for (int i = 0; i < count; i++) 
+        {
+            const Treasure* treasure = treasureAt(&reader, matches[i].entry.offset);
+            if (treasure == NULL || TREASURE_IS_DELETED(treasure)) 
+            {
+                continue;
+            }
+            
+            fprintf(out, "ID: %d\n", treasure->treasureId);
+            fprintf(out, "User: %s\n", treasure->userName);
+            fprintf(out, "Location: %.6f, %.6f\n", treasure->latitude, treasure->longitude);
+            fprintf(out, "Distance: %.0f m\n", matches[i].distance);
+            fprintf(out, "Value: %d\n", treasure->value);
+            fprintf(out, "-------------------\n");
+            shown++;
+        }
+        
+        if (shown == 0) 
+        {
+            fprintf(out, "No treasures found near this point.\n");
+        }
+        
+        closeTreasureReader(&reader);
+        free(matches);
+        
+    } 
+    else if (strcmp(cmd, "calculate_score") == 0) 
+    {
+        int all = param[0] == '\0' || strcmp(param, "all") == 0;
+        if (all) 
+        {
+            fprintf(out, "\n--- MONITOR: SCORES FOR ALL HUNTS (request %u) ---\n", request_id);
+        } 
+        else 
+        {
+            fprintf(out, "\n--- MONITOR: SCORES FOR HUNT: %s (request %u) ---\n", param, request_id);
+        }
+        
+        // The workers take one hunt at a time, so many small hunts and a
+        // few large ones both spread over every core
+        char* single[1] = { param };
+        char** hunts = single;
+        int hunt_count = 1;
+        if (all) 
+        {
+            catalog_refresh(&catalog);
+            hunts = malloc((catalog.count + 1) * sizeof(char*));
+            if (hunts == NULL) 
+            {
+                fprintf(out, "Error: Out of memory\n");
+                return;
+            }
+            hunt_count = 0;
+            for (int i = 0; i < catalog.count; i++) 
+            {
+                if (catalog.hunts[i].is_hunt) 
+                {
+                    hunts[hunt_count++] = catalog.hunts[i].name;
+                }
+            }
+        }
+        
+        ScoreOutput output = { out, 0, 0 };
+        score_pool_run(&score_pool, hunts, hunt_count, print_score_report, &output);
+        if (all) 
+        {
+            free(hunts);
+        }
+        
+        if (hunt_count == 0) 
+        {
+            fprintf(out, "No hunts found.\n");
+        }
+        if (output.hunts_failed > 0) 
+        {
+            fprintf(out, "--- END OF SCORES (%d hunts, %d failed) ---\n\n", output.hunts_scored, output.hunts_failed);
+        }
+        else 
+        {
+            fprintf(out, "--- END OF SCORES (%d hunts) ---\n\n", output.hunts_scored);
+        }
+        
+    } 
+    else if (strcmp(cmd, "stats") == 0) 
+    {
+        fprintf(out, "\n--- MONITOR: COMMAND STATISTICS (request %u) ---\n", request_id);
+        printOperationStats(out);
+        fprintf(out, "--- END OF STATISTICS ---\n\n");
+        
+    } 
+    else if (strcmp(cmd, "stop_monitor") == 0) 
+    {
+        fprintf(out, "\n--- MONITOR: STOPPING (request %u) ---\n", request_id);
+        fprintf(out, "Monitor process (PID: %d) is shutting down...\n", getpid());
         
         // Simulate a delay before shutting down
         usleep(500000);  // 0.5 second delay
         
-        printf("Monitor process terminated.\n");
+        fprintf(out, "Monitor process terminated.\n");
+        stop_requested = 1;
+    }
+}
+
+// Write a whole result frame to the hub, however the pipe splits it
+void send_result(unsigned int request_id, const char* result, size_t length) 
+{
+    CommandFrame frame;
+    frame.length = length;
+    frame.request_id = request_id;
+    
+    struct iovec iov[2];
+    iov[0].iov_base = &frame;
+    iov[0].iov_len = sizeof(frame);
+    iov[1].iov_base = (void*)result;
+    iov[1].iov_len = length;
+    
+    int index = 0;
+    while (index < 2) 
+    {
+        ssize_t n = writev(monitor_result_fd, iov + index, 2 - index);
+        if (n == -1 && errno == EINTR) 
+        {
+            continue;
+        }
+        if (n <= 0) 
+        {
+            // The hub is gone, nobody is left to answer
+            exit(EXIT_FAILURE);
+        }
+        while (index < 2 && (size_t)n >= iov[index].iov_len) 
+        {
+            n -= iov[index].iov_len;
+            index++;
+        }
+        if (index < 2) 
+        {
+            iov[index].iov_base = (char*)iov[index].iov_base + n;
+            iov[index].iov_len -= n;
+        }
+    }
+}
+
+// Send a message the monitor prints on its own (not in answer to a command)
+// as a result, so it reaches the hub in order with the results.
+// Request 0 is never sent by the hub, so it counts toward no latency.
+void send_notice(const char* format, ...) 
+{
+    char notice[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(notice, sizeof(notice), format, args);
+    va_end(args);
+    if (length > 0) 
+    {
+        send_result(0, notice, (size_t)length < sizeof(notice) ? (size_t)length : sizeof(notice) - 1);
+    }
+    send_result(0, NULL, 0);
+}
+
+// Write function of a result stream: whatever stdio flushes goes to the
+// hub as frames of at most RESULT_CHUNK bytes
+ssize_t write_result_stream(void* cookie, const char* data, size_t size) 
+{
+    unsigned int request_id = *(unsigned int*)cookie;
+    size_t sent = 0;
+    while (sent < size) 
+    {
+        size_t chunk = size - sent < RESULT_CHUNK ? size - sent : RESULT_CHUNK;
+        send_result(request_id, data + sent, chunk);
+        sent += chunk;
+    }
+    return size;
+}
+
+// Run one command, streaming its output back to the hub a chunk at a time
+// as it is printed, so the monitor never holds a whole result and the hub
+// decides when and where results are shown
+void answer_command(unsigned int request_id, const char* payload) 
+{
+    // Every command is counted under its name, up to its result being sent
+    char cmd[50] = {0};
+    sscanf(payload, "%49s", cmd);
+    StatsTimer timer;
+    beginOperation(&timer, cmd);
+    
+    cookie_io_functions_t functions = { NULL, write_result_stream, NULL, NULL };
+    FILE* out = fopencookie(&request_id, "w", functions);
+    if (out == NULL || setvbuf(out, NULL, _IOFBF, RESULT_CHUNK) != 0) 
+    {
+        perror("Monitor: Failed to open result stream");
+        exit(EXIT_FAILURE);
+    }
+    
+    execute_command(out, request_id, payload);
+    fclose(out);
+    send_result(request_id, NULL, 0);
+    endOperation(&timer);
+    
+    if (stop_requested) 
+    {
         exit(EXIT_SUCCESS);
     }
 }
 
+// Execute, in order, every complete frame queued on the command channel.
+// Called from the monitor loop whenever the channel becomes readable.
+void drain_command_channel() 
+{
+    while (1) 
+    {
+        ssize_t n = read(monitor_command_fd, pending_frames + pending_length,
+                         sizeof(pending_frames) - pending_length);
+        if (n > 0) 
+        {
+            pending_length += n;
+        }
+        
+        // Execute every complete frame received so far
+        size_t used = 0;
+        while (pending_length - used >= sizeof(CommandFrame)) 
+        {
+            CommandFrame frame;
+            memcpy(&frame, pending_frames + used, sizeof(frame));
+            if (frame.length > MAX_COMMAND_PAYLOAD) 
+            {
+                send_notice("Monitor: Malformed command frame, stopping.\n");
+                exit(EXIT_FAILURE);
+            }
+            if (pending_length - used < sizeof(frame) + frame.length) 
+            {
+                break;
+            }
+            
+            char payload[MAX_COMMAND_PAYLOAD + 1];
+            memcpy(payload, pending_frames + used + sizeof(frame), frame.length);
+            payload[frame.length] = '\0';
+            used += sizeof(frame) + frame.length;
+            
+            answer_command(frame.request_id, payload);
+        }
+        
+        memmove(pending_frames, pending_frames + used, pending_length - used);
+        pending_length -= used;
+        
+        if (n == 0) 
+        {
+            // Hub closed the channel
+            exit(EXIT_SUCCESS);
+        }
+        if (n == -1) 
+        {
+            if (errno != EINTR && errno != EAGAIN) 
+            {
+                perror("Monitor: Failed to read command channel");
+            }
+            if (errno != EINTR) 
+            {
+                break;
+            }
+        }
+    }
+}
+
+// Monitor main loop: waits on the command channel and on a signalfd, so
+// commands and signals are both handled here rather than in signal handlers
+void run_monitor_loop() 
+{
+    // Signals are delivered through the signalfd only
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
+    
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) 
+    {
+        perror("Monitor: Failed to block signals");
+        exit(EXIT_FAILURE);
+    }
+    
+    // A dead score worker has to show up as a write error, not kill the monitor
+    signal(SIGPIPE, SIG_IGN);
+    
+    // Workers are forked before the event loop descriptors exist, with the
+    // signals above blocked; they leave once the monitor closes their pipes
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (score_pool_start(&score_pool, cores > 0 ? cores : 1) == -1) 
+    {
+        perror("Monitor: Failed to start score workers");
+        exit(EXIT_FAILURE);
+    }
+    atexit(stop_score_pool);
+    
+    int signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (signal_fd == -1 || epoll_fd == -1) 
+    {
+        perror("Monitor: Failed to set up event loop");
+        exit(EXIT_FAILURE);
+    }
+    
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = monitor_command_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, monitor_command_fd, &event);
+    event.data.fd = signal_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event);
+    
+    if (catalog_init(&catalog) == -1) 
+    {
+        perror("Monitor: Failed to watch hunt directories");
+        exit(EXIT_FAILURE);
+    }
+    event.data.fd = catalog.inotify_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, catalog.inotify_fd, &event);
+    
+    send_notice("Monitor process started with PID: %d\nReady to receive commands.\n", getpid());
+    
+    // Keep the monitor running until it receives a stop command
+    while (1) 
+    {
+        struct epoll_event events[8];
+        int count = epoll_wait(epoll_fd, events, 8, -1);
+        if (count == -1) 
+        {
+            if (errno == EINTR) 
+            {
+                continue;
+            }
+            perror("Monitor: Event loop failed");
+            exit(EXIT_FAILURE);
+        }
+        
+        for (int i = 0; i < count; i++) 
+        {
+            if (events[i].data.fd == monitor_command_fd) 
+            {
+                drain_command_channel();
+            } 
+            else if (events[i].data.fd == catalog.inotify_fd) 
+            {
+                catalog_handle_events(&catalog);
+            } 
+            else if (events[i].data.fd == signal_fd) 
+            {
+                struct signalfd_siginfo info;
+                if (read(signal_fd, &info, sizeof(info)) != sizeof(info)) 
+                {
+                    continue;
+                }
+                
+                if (info.ssi_signo == SIGUSR1) 
+                {
+                    // SIGUSR1 still just means "check the command channel"
+                    drain_command_channel();
+                } 
+                else 
+                {
+                    send_notice("Monitor process (PID: %d) received signal %d, shutting down...\n",
+                                getpid(), info.ssi_signo);
+                    exit(EXIT_SUCCESS);
+                }
+            }
+        }
+    }
+}
+
+// Read exactly length bytes, or return -1 at EOF or on error
+int read_full(int fd, void* buffer, size_t length) 
+{
+    size_t done = 0;
+    while (done < length) 
+    {
+        ssize_t n = read(fd, (char*)buffer + done, length - done);
+        if (n == -1 && errno == EINTR) 
+        {
+            continue;
+        }
+        if (n <= 0) 
+        {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+// Remember when a command went out
+void record_sent(unsigned int request_id) 
+{
+    pthread_mutex_lock(&request_lock);
+    if (request_id >= sent_capacity) 
+    {
+        size_t capacity = sent_capacity ? sent_capacity * 2 : 1024;
+        while (capacity <= request_id) 
+        {
+            capacity *= 2;
+        }
+        struct timespec* times = realloc(sent_times, capacity * sizeof(struct timespec));
+        if (times != NULL) 
+        {
+            memset(times + sent_capacity, 0, (capacity - sent_capacity) * sizeof(struct timespec));
+            sent_times = times;
+            sent_capacity = capacity;
+        }
+    }
+    if (request_id < sent_capacity) 
+    {
+        clock_gettime(CLOCK_MONOTONIC, &sent_times[request_id]);
+    }
+    pthread_mutex_unlock(&request_lock);
+}
+
+// Note how long a command took once its result has been rendered
+void record_answered(unsigned int request_id) 
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    
+    pthread_mutex_lock(&request_lock);
+    if (request_id < sent_capacity && sent_times[request_id].tv_sec != 0) 
+    {
+        if (latency_count == latency_capacity) 
+        {
+            size_t capacity = latency_capacity ? latency_capacity * 2 : 1024;
+            double* grown = realloc(latencies, capacity * sizeof(double));
+            if (grown != NULL) 
+            {
+                latencies = grown;
+                latency_capacity = capacity;
+            }
+        }
+        if (latency_count < latency_capacity) 
+        {
+            struct timespec* sent = &sent_times[request_id];
+            latencies[latency_count++] = (now.tv_sec - sent->tv_sec) * 1e3 +
+                                         (now.tv_nsec - sent->tv_nsec) / 1e6;
+        }
+    }
+    pthread_mutex_unlock(&request_lock);
+}
+
+// Render thread: copy every result frame to the current output as it
+// arrives, each in one piece, so a frame never interleaves with a prompt.
+// A command's latency ends with the empty frame closing its result.
+// Ends when the monitor (and its score workers) closed the result pipe.
+void* render_results(void* arg) 
+{
+    int fd = *(int*)arg;
+    free(arg);
+    
+    static char buffer[RESULT_CHUNK];
+    CommandFrame frame;
+    while (read_full(fd, &frame, sizeof(frame)) == 0) 
+    {
+        if (frame.length == 0) 
+        {
+            record_answered(frame.request_id);
+            continue;
+        }
+        
+        pthread_mutex_lock(&output_lock);
+        FILE* out = result_output != NULL ? result_output : stdout;
+        flockfile(out);
+        
+        size_t left = frame.length;
+        int failed = 0;
+        while (left > 0 && !failed) 
+        {
+            size_t chunk = left < sizeof(buffer) ? left : sizeof(buffer);
+            failed = read_full(fd, buffer, chunk) == -1;
+            if (!failed) 
+            {
+                fwrite(buffer, 1, chunk, out);
+                left -= chunk;
+            }
+        }
+        fflush(out);
+        
+        funlockfile(out);
+        pthread_mutex_unlock(&output_lock);
+        if (failed) 
+        {
+            break;
+        }
+    }
+    
+    close(fd);
+    return NULL;
+}
+
+// Wait until the last monitor's results have all been rendered
+void join_render_thread() 
+{
+    if (render_running) 
+    {
+        pthread_join(render_thread, NULL);
+        render_running = 0;
+    }
+}
+
 // Start the monitor process
 void start_monitor() {
     if (monitor_pid != -1) 
@@ -315,6 +870,28 @@ void start_monitor() {
         return;
     }
     
+    // Command channel: the hub writes frames on one end, the monitor reads the other
+    int channel[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, channel) == -1) 
+    {
+        perror("Failed to create command channel");
+        return;
+    }
+    
+    // Result pipe: the monitor writes result frames, the render thread reads them
+    int results[2];
+    if (pipe(results) == -1) 
+    {
+        perror("Failed to create result pipe");
+        close(channel[0]);
+        close(channel[1]);
+        return;
+    }
+    
+    // The previous render thread has to be gone before forking, a thread
+    // holding the stdout lock would leave it locked in the child
+    join_render_thread();
+    fflush(stdout);
     monitor_pid = fork();
     
     if (monitor_pid < 0) 
@@ -325,32 +902,60 @@ void start_monitor() {
     } 
     else if (monitor_pid == 0) 
     {
-        
-        // Set up signal handler for commands
-        struct sigaction sa;
-        sa.sa_handler = handle_command_signal;
-        sigemptyset(&sa.sa_mask);
-        sa.sa_flags = 0;
-        
-        if (sigaction(SIGUSR1, &sa, NULL) == -1)
+        // The monitor never reads commands from the hub's input. It must not
+        // share its file offset either: exit() winds a buffered, seekable
+        // input stream back, and the hub would read lines again.
+        int null_fd = open("/dev/null", O_RDONLY);
+        if (null_fd != -1) 
         {
-            perror("Monitor: Failed to set up SIGUSR1 handler");
-            exit(EXIT_FAILURE);
+            dup2(null_fd, STDIN_FILENO);
+            if (batch_input != NULL) 
+            {
+                dup2(null_fd, fileno(batch_input));
+            }
+            close(null_fd);
         }
         
-        printf("Monitor process started with PID: %d\n", getpid());
-        printf("Ready to receive commands.\n");
-        
-        // Keep the monitor running until it receives a stop command
-        while (1) 
-        {
-            sleep(1);
-        }
+        close(channel[0]);
+        close(results[0]);
+        monitor_command_fd = channel[1];
+        monitor_result_fd = results[1];
+        fcntl(monitor_command_fd, F_SETFL, O_NONBLOCK);
         
+        run_monitor_loop();
         exit(EXIT_SUCCESS);
     }
     else 
     {
+        close(channel[1]);
+        close(results[1]);
+        if (command_fd != -1) 
+        {
+            close(command_fd);
+        }
+        command_fd = channel[0];
+        
+        int* fd = malloc(sizeof(int));
+        if (fd != NULL) 
+        {
+            *fd = results[0];
+        }
+        // The thread starts with SIGCHLD blocked so the handler always runs
+        // on the main thread, where wait_for_monitor expects it
+        sigset_t block, previous;
+        sigemptyset(&block);
+        sigaddset(&block, SIGCHLD);
+        pthread_sigmask(SIG_BLOCK, &block, &previous);
+        if (fd == NULL || pthread_create(&render_thread, NULL, render_results, fd) != 0) 
+        {
+            printf("Error: Failed to start the result renderer, results will not be shown.\n");
+            free(fd);
+        }
+        else 
+        {
+            render_running = 1;
+        }
+        pthread_sigmask(SIG_SETMASK, &previous, NULL);
         printf("Started monitor process with PID: %d\n", monitor_pid);
     }
 }
@@ -370,29 +975,36 @@ void send_command(const char* command, const char* param)
         return;
     }
     
-    // Write command to file for the monitor to read
-    FILE *cmdFile = fopen(command_file, "w");
-    if (cmdFile == NULL) 
+    // Frame the command so queued commands never overwrite each other
+    char payload[MAX_COMMAND_PAYLOAD + 1];
+    int length = snprintf(payload, sizeof(payload), "%s %s", command, param != NULL ? param : "");
+    if (length < 0 || length > MAX_COMMAND_PAYLOAD) 
     {
-        perror("Failed to open command file");
+        printf("Error: Command too long.\n");
         return;
     }
     
-    if (param != NULL) 
-    {
-        fprintf(cmdFile, "%s %s", command, param);
-    } 
-    else 
-    {
-        fprintf(cmdFile, "%s", command);
-    }
+    CommandFrame frame;
+    frame.length = length;
+    frame.request_id = next_request_id++;
+    record_sent(frame.request_id);
     
-    fclose(cmdFile);
+    struct iovec iov[2];
+    iov[0].iov_base = &frame;
+    iov[0].iov_len = sizeof(frame);
+    iov[1].iov_base = payload;
+    iov[1].iov_len = length;
     
-    // Send signal to monitor to process the command
-    if (kill(monitor_pid, SIGUSR1) == -1) 
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = iov;
+    message.msg_iovlen = 2;
+    
+    // MSG_NOSIGNAL: a dead monitor shows up as an error here, not as SIGPIPE
+    if (sendmsg(command_fd, &message, MSG_NOSIGNAL) != (ssize_t)(sizeof(frame) + length)) 
     {
-        perror("Failed to send signal to monitor");
+        perror("Failed to send command to monitor");
+        return;
     }
 }
 
@@ -402,24 +1014,213 @@ void list_hunts()
     send_command("list_hunts", NULL);
 }
 
-// List all treasures in a hunt
-void list_treasures() 
+// The commands below take their arguments from the rest of a batch line
+// (args), or prompt for them when args is NULL
+
+// List the treasures in a hunt, optionally paged and filtered:
+// hunt_id [--offset N] [--limit N] [user=NAME] [value>=N]
+//         [bbox=MIN_LAT,MIN_LON,MAX_LAT,MAX_LON] [--compact]
+//         [--format=text|json|ndjson|binary]
+void list_treasures(const char* args) 
 {
+    char line[MAX_COMMAND_PAYLOAD];
+    if (args == NULL) 
+    {
+        printf("Enter hunt ID and options ([--offset N] [--limit N] [user=NAME] [value>=N] "
+               "[bbox=MIN_LAT,MIN_LON,MAX_LAT,MAX_LON] [--compact] [--format=FORMAT]): ");
+        if (scanf(" %255[^\n]", line) != 1) 
+        {
+            return;
+        }
+    } 
+    else 
+    {
+        snprintf(line, sizeof(line), "%s", args + strspn(args, " \t"));
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+    
+    // The monitor checks the options, the hub only needs the hunt ID
     char huntId[50];
-    printf("Enter hunt ID: ");
-    scanf("%s", huntId);
+    if (sscanf(line, "%49s", huntId) != 1) 
+    {
+        printf("Error: list_treasures needs a hunt ID.\n");
+        return;
+    }
+    
+    send_command("list_treasures", line);
+}
+
+// List the treasures within a radius of a point
+void near_treasures(const char* args) 
+{
+    char huntId[50];
+    double latitude, longitude, radius;
+    if (args == NULL) 
+    {
+        printf("Enter hunt ID: ");
+        scanf("%49s", huntId);
+        
+        printf("Enter latitude, longitude and radius in metres: ");
+        if (scanf("%lf %lf %lf", &latitude, &longitude, &radius) != 3) 
+        {
+            printf("Error: Invalid coordinates.\n");
+            scanf("%*s");
+            return;
+        }
+    } 
+    else if (sscanf(args, "%49s %lf %lf %lf", huntId, &latitude, &longitude, &radius) != 4) 
+    {
+        printf("Error: near needs a hunt ID, a latitude, a longitude and a radius.\n");
+        return;
+    }
     
-    send_command("list_treasures", huntId);
+    char param[150];
+    sprintf(param, "%s %.6f %.6f %.1f", huntId, latitude, longitude, radius);
+    send_command("near", param);
 }
 
 // View a specific treasure
-void view_treasure() 
+void view_treasure(const char* args) 
 {
     char huntId[50];
-    printf("Enter hunt ID: ");
-    scanf("%s", huntId);
+    int treasureId;
+    if (args == NULL) 
+    {
+        printf("Enter hunt ID: ");
+        scanf("%49s", huntId);
+        
+        printf("Enter treasure ID to view: ");
+        if (scanf("%d", &treasureId) != 1) 
+        {
+            printf("Error: Invalid treasure ID.\n");
+            scanf("%*s");
+            return;
+        }
+    } 
+    else if (sscanf(args, "%49s %d", huntId, &treasureId) != 2) 
+    {
+        printf("Error: view_treasure needs a hunt ID and a treasure ID.\n");
+        return;
+    }
+    
+    char param[100];
+    sprintf(param, "%s %d", huntId, treasureId);
+    send_command("view_treasure", param);
+}
+
+// Calculate the scores of one hunt, or of every hunt
+void calculate_score(const char* args) 
+{
+    char huntId[50];
+    if (args == NULL) 
+    {
+        printf("Enter hunt ID (or 'all'): ");
+        scanf("%49s", huntId);
+    } 
+    else if (sscanf(args, "%49s", huntId) != 1) 
+    {
+        strcpy(huntId, "all");
+    }
     
-    send_command("view_treasure", huntId);
+    send_command("calculate_score", huntId);
+}
+
+// Send results to a file from now on, or back to the terminal with "-".
+// Results already on their way may land on either side of the switch.
+void redirect_results(const char* args) 
+{
+    char path[256];
+    if (args == NULL) 
+    {
+        printf("Enter output file (or - for the terminal): ");
+        scanf("%255s", path);
+    } 
+    else if (sscanf(args, "%255s", path) != 1) 
+    {
+        printf("Error: redirect needs a file name or -.\n");
+        return;
+    }
+    
+    FILE* out = NULL;
+    if (strcmp(path, "-") != 0) 
+    {
+        out = fopen(path, "w");
+        if (out == NULL) 
+        {
+            perror("Failed to open output file");
+            return;
+        }
+    }
+    
+    pthread_mutex_lock(&output_lock);
+    if (result_output != NULL) 
+    {
+        fclose(result_output);
+    }
+    result_output = out;
+    pthread_mutex_unlock(&output_lock);
+    
+    printf("Results now go to %s\n", out != NULL ? path : "the terminal");
+}
+
+static int compare_latency(const void* a, const void* b) 
+{
+    double left = *(const double*)a;
+    double right = *(const double*)b;
+    return (left > right) - (left < right);
+}
+
+// Latency summary over every answered command: count, average, p50, p99
+// and slowest. Returns the number of commands answered.
+size_t summarize_latency(double* average, double* p50, double* p99, double* slowest) 
+{
+    pthread_mutex_lock(&request_lock);
+    size_t count = latency_count;
+    double* sorted = count > 0 ? malloc(count * sizeof(double)) : NULL;
+    if (sorted != NULL) 
+    {
+        memcpy(sorted, latencies, count * sizeof(double));
+    }
+    pthread_mutex_unlock(&request_lock);
+    
+    if (sorted == NULL) 
+    {
+        return 0;
+    }
+    
+    qsort(sorted, count, sizeof(double), compare_latency);
+    double total = 0;
+    for (size_t i = 0; i < count; i++) 
+    {
+        total += sorted[i];
+    }
+    *average = total / count;
+    *p50 = sorted[(count - 1) / 2];
+    *p99 = sorted[(count - 1) * 99 / 100];
+    *slowest = sorted[count - 1];
+    free(sorted);
+    
+    return count;
+}
+
+// Ask the monitor for its per-command counters
+void show_stats() 
+{
+    send_command("stats", NULL);
+}
+
+// Show how long commands took to be answered
+void print_latency() 
+{
+    double average, p50, p99, slowest;
+    size_t count = summarize_latency(&average, &p50, &p99, &slowest);
+    if (count == 0) 
+    {
+        printf("No commands answered yet.\n");
+        return;
+    }
+    printf("Answered %zu commands: average %.3f ms, p50 %.3f ms, p99 %.3f ms, slowest %.3f ms\n",
+           count, average, p50, p99, slowest);
 }
 
 // Stop the monitor process
@@ -437,46 +1238,208 @@ void stop_monitor()
         return;
     }
     
-    is_monitor_stopping = 1;
+    // Flag only after sending, send_command refuses to talk to a stopping monitor
     send_command("stop_monitor", NULL);
+    is_monitor_stopping = 1;
+}
+
+// Block until the SIGCHLD handler has seen the monitor exit. The render
+// thread runs with SIGCHLD blocked, so the signal always lands here.
+void wait_for_monitor() 
+{
+    sigset_t block, previous;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &previous);
+    while (monitor_pid != -1) 
+    {
+        sigsuspend(&previous);
+    }
+    sigprocmask(SIG_SETMASK, &previous, NULL);
+}
+
+// Stop a running monitor and wait until all of its results are shown
+void shut_down_monitor() 
+{
+    if (monitor_pid != -1 && !is_monitor_stopping) 
+    {
+        stop_monitor();
+    }
+    wait_for_monitor();
+    join_render_thread();
+}
+
+// Run one hub command other than exit. args is the rest of the line in
+// batch mode and NULL when the command should prompt.
+void dispatch_command(const char* input, const char* args) 
+{
+    if (strcmp(input, "start_monitor") == 0) 
+    {
+        start_monitor();
+    } 
+    else if (strcmp(input, "list_hunts") == 0) 
+    {
+        list_hunts();
+    } 
+    else if (strcmp(input, "list_treasures") == 0) 
+    {
+        list_treasures(args);
+    } 
+    else if (strcmp(input, "view_treasure") == 0) 
+    {
+        view_treasure(args);
+    } 
+    else if (strcmp(input, "near") == 0) 
+    {
+        near_treasures(args);
+    } 
+    else if (strcmp(input, "calculate_score") == 0) 
+    {
+        calculate_score(args);
+    } 
+    else if (strcmp(input, "redirect") == 0) 
+    {
+        redirect_results(args);
+    } 
+    else if (strcmp(input, "latency") == 0) 
+    {
+        print_latency();
+    } 
+    else if (strcmp(input, "stats") == 0) 
+    {
+        show_stats();
+    } 
+    else if (strcmp(input, "stop_monitor") == 0) 
+    {
+        stop_monitor();
+        
+        // A script may start the monitor again on its next line
+        if (args != NULL) 
+        {
+            wait_for_monitor();
+        }
+    } 
+    else 
+    {
+        printf("Unknown command: %s\n", input);
+    }
 }
 
-int main() 
+static double seconds_since(const struct timespec* since) 
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+// Batch mode: one command per line with its arguments, run back to back
+// without prompts or waiting for results. Blank lines and lines starting
+// with # are skipped. The monitor is stopped at the end of the input (or
+// at "exit") and throughput and latency go to stderr, keeping stdout for
+// the results themselves.
+int run_batch(const char* path) 
+{
+    FILE* input = stdin;
+    if (strcmp(path, "-") != 0) 
+    {
+        input = fopen(path, "r");
+        if (input == NULL) 
+        {
+            perror("Failed to open command file");
+            return 1;
+        }
+    }
+    batch_input = input;
+    
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    char* line = NULL;
+    size_t line_size = 0;
+    int commands = 0;
+    while (getline(&line, &line_size, input) != -1) 
+    {
+        char command[50];
+        int consumed = 0;
+        if (line[0] == '#' || sscanf(line, "%49s%n", command, &consumed) != 1) 
+        {
+            continue;
+        }
+        
+        if (strcmp(command, "exit") == 0) 
+        {
+            break;
+        }
+        dispatch_command(command, line + consumed);
+        commands++;
+    }
+    free(line);
+    
+    shut_down_monitor();
+    if (input != stdin) 
+    {
+        fclose(input);
+    }
+    batch_input = NULL;
+    double elapsed = seconds_since(&start);
+    
+    double average, p50, p99, slowest;
+    size_t answered = summarize_latency(&average, &p50, &p99, &slowest);
+    fprintf(stderr, "Batch: %d commands, %zu answered in %.3f s (%.0f commands/s)\n",
+            commands, answered, elapsed, elapsed > 0 ? answered / elapsed : 0);
+    if (answered > 0) 
+    {
+        fprintf(stderr, "Latency: average %.3f ms, p50 %.3f ms, p99 %.3f ms, slowest %.3f ms\n",
+                average, p50, p99, slowest);
+    }
+    
+    return 0;
+}
+
+int main(int argc, char* argv[]) 
 {
     // Set up signal handlers
     setup_signal_handlers();
     
+    int opt;
+    const char* batch_path = NULL;
+    while ((opt = getopt(argc, argv, "f:")) != -1) 
+    {
+        if (opt == 'f') 
+        {
+            batch_path = optarg;
+        } 
+        else 
+        {
+            fprintf(stderr, "Usage: %s [-f commands_file|-]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (batch_path != NULL) 
+    {
+        return run_batch(batch_path);
+    }
+    
     char input[50];
     
     printf("Treasure Hub - Interactive Interface\n");
-    printf("Available commands: start_monitor, list_hunts, list_treasures, view_treasure, stop_monitor, exit\n");
+    printf("Available commands: start_monitor, list_hunts, list_treasures, view_treasure, near, calculate_score, redirect, latency, stats, stop_monitor, exit\n");
     
     while (1) 
     {
         printf("\n> ");
-        scanf("%s", input);
         
-        if (strcmp(input, "start_monitor") == 0) 
-        {
-            start_monitor();
-        } 
-        else if (strcmp(input, "list_hunts") == 0) 
-        {
-            list_hunts();
-        } 
-        else if (strcmp(input, "list_treasures") == 0) 
+        // End of input leaves like exit, stopping the monitor first
+        // instead of spinning on a failed scanf
+        if (scanf("%49s", input) != 1) 
         {
-            list_treasures();
-        } 
-        else if (strcmp(input, "view_treasure") == 0) 
-        {
-            view_treasure();
-        } 
-        else if (strcmp(input, "stop_monitor") == 0) 
-        {
-            stop_monitor();
-        } 
-        else if (strcmp(input, "exit") == 0)
+            printf("\n");
+            shut_down_monitor();
+            printf("Exiting Treasure Hub...\n");
+            break;
+        }
+        
+        if (strcmp(input, "exit") == 0)
         {
             if (monitor_pid != -1) 
             {
@@ -484,15 +1447,17 @@ int main()
             } 
             else 
             {
+                // Whatever the monitor answered last is still shown
+                join_render_thread();
                 printf("Exiting Treasure Hub...\n");
                 break;
             }
         } 
         else 
         {
-            printf("Unknown command: %s\n", input);
+            dispatch_command(input, NULL);
         }
     }
     
     return 0;
-}
\ No newline at end of file
+}
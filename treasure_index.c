@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "treasure.h"
+#include "treasure_index.h"
+#include "treasure_stats.h"
+#include "treasure_reader.h"
+
+//Entries written per write() call, staged in a per-thread buffer
+#define INDEX_CHUNK 1024
+
+static void fillHeader(TreasureIndexHeader* header, const struct stat* st,
+                       int entryCount, int deletedCount)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, TREASURE_INDEX_MAGIC, 4);
+    header->version = TREASURE_INDEX_VERSION;
+    header->entryCount = entryCount;
+    header->deletedCount = deletedCount;
+    header->dataSize = st->st_size;
+    header->dataMtimeSec = st->st_mtim.tv_sec;
+    header->dataMtimeNsec = st->st_mtim.tv_nsec;
+}
+
+//Check that an index header describes the given treasures file
+static int headerMatches(const TreasureIndexHeader* header, const struct stat* st)
+{
+    return memcmp(header->magic, TREASURE_INDEX_MAGIC, 4) == 0 &&
+           header->version == TREASURE_INDEX_VERSION &&
+           header->dataSize == st->st_size &&
+           header->dataMtimeSec == st->st_mtim.tv_sec &&
+           header->dataMtimeNsec == st->st_mtim.tv_nsec;
+}
+
+int rebuildTreasureIndex(const char* huntId)
+{
+    char filePath[100];
+    char indexPath[100];
+    char tempPath[TREASURE_TEMP_PATH_MAX];
+    sprintf(filePath, "./%s/treasures", huntId);
+    sprintf(indexPath, "./%s/treasures.idx", huntId);
+
+    TreasureReader reader;
+    if (openTreasureReader(&reader, filePath) == -1)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    fstat(reader.fd, &st);
+
+    //Readers rebuild a stale index too, so each rebuild has its own temp file
+    int indexFd = createTempFile(indexPath, tempPath);
+    if (indexFd == -1)
+    {
+        perror("Failed to create treasure index");
+        closeTreasureReader(&reader);
+        return -1;
+    }
+
+    //Header is rewritten with the final count once all entries are out
+    TreasureIndexHeader header;
+    fillHeader(&header, &st, 0, 0);
+    write(indexFd, &header, sizeof(header));
+
+    static __thread TreasureIndexEntry entries[INDEX_CHUNK];
+    const Treasure* treasure;
+    int entryCount = 0;
+    int deletedCount = 0;
+    int pending = 0;
+
+    while ((treasure = nextTreasure(&reader)) != NULL)
+    {
+        entries[pending].treasureId = abs(treasure->treasureId);
+        entries[pending].reserved = 0;
+        entries[pending].offset = reader.recordOffset;
+        if (TREASURE_IS_DELETED(treasure))
+        {
+            deletedCount++;
+        }
+
+        if (++pending == INDEX_CHUNK)
+        {
+            write(indexFd, entries, sizeof(entries));
+            entryCount += pending;
+            pending = 0;
+        }
+    }
+    write(indexFd, entries, pending * sizeof(TreasureIndexEntry));
+    entryCount += pending;
+    closeTreasureReader(&reader);
+
+    header.entryCount = entryCount;
+    header.deletedCount = deletedCount;
+    pwrite(indexFd, &header, sizeof(header), 0);
+    close(indexFd);
+
+    //Swap in atomically so concurrent readers never see a half-built index
+    if (rename(tempPath, indexPath) == -1)
+    {
+        perror("Failed to install treasure index");
+        unlink(tempPath);
+        return -1;
+    }
+
+    return 0;
+}
+
+//Open the index of a hunt, rebuilding it first if it is missing or stale
+static int openFreshIndex(const char* huntId, TreasureIndexHeader* header)
+{
+    char filePath[100];
+    char indexPath[100];
+    sprintf(filePath, "./%s/treasures", huntId);
+    sprintf(indexPath, "./%s/treasures.idx", huntId);
+
+    struct stat st;
+    if (stat(filePath, &st) == -1)
+    {
+        return -1;
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        int indexFd = open(indexPath, O_RDONLY);
+        statsTally.bytesRead += indexFd != -1 ? sizeof(*header) : 0;
+        if (indexFd != -1)
+        {
+            if (pread(indexFd, header, sizeof(*header), 0) == sizeof(*header) &&
+                headerMatches(header, &st))
+            {
+                return indexFd;
+            }
+            close(indexFd);
+        }
+
+        if (rebuildTreasureIndex(huntId) == -1 || stat(filePath, &st) == -1)
+        {
+            return -1;
+        }
+    }
+
+    return -1;
+}
+
+static int readEntry(int indexFd, int position, TreasureIndexEntry* entry)
+{
+    off_t at = sizeof(TreasureIndexHeader) + (off_t)position * sizeof(TreasureIndexEntry);
+    statsTally.bytesRead += sizeof(*entry);
+    return pread(indexFd, entry, sizeof(*entry), at) == sizeof(*entry) ? 0 : -1;
+}
+
+int findTreasurePosition(const char* huntId, int treasureId, int* position, off_t* offset)
+{
+    TreasureIndexHeader header;
+    int indexFd = openFreshIndex(huntId, &header);
+    if (indexFd == -1)
+    {
+        return -1;
+    }
+
+    TreasureIndexEntry entry;
+    int found = 0;
+    int at = treasureId - 1;
+
+    //IDs are usually dense, so the entry at position ID-1 is the first guess
+    if (treasureId >= 1 && treasureId <= header.entryCount &&
+        readEntry(indexFd, at, &entry) == 0 &&
+        entry.treasureId == treasureId)
+    {
+        found = 1;
+    }
+    else
+    {
+        int low = 0;
+        int high = header.entryCount - 1;
+        while (low <= high)
+        {
+            at = low + (high - low) / 2;
+            if (readEntry(indexFd, at, &entry) == -1)
+            {
+                break;
+            }
+            if (entry.treasureId == treasureId)
+            {
+                found = 1;
+                break;
+            }
+            if (entry.treasureId < treasureId)
+            {
+                low = at + 1;
+            }
+            else
+            {
+                high = at - 1;
+            }
+        }
+    }
+    close(indexFd);
+
+    if (found)
+    {
+        *position = at;
+        *offset = entry.offset;
+    }
+    return found;
+}
+
+int findTreasureOffset(const char* huntId, int treasureId, off_t* offset)
+{
+    int position;
+    return findTreasurePosition(huntId, treasureId, &position, offset);
+}
+
+int appendTreasureIndex(const char* huntId, const struct stat* before,
+                        const TreasureIndexEntry* entries, int count)
+{
+    char filePath[100];
+    char indexPath[100];
+    sprintf(filePath, "./%s/treasures", huntId);
+    sprintf(indexPath, "./%s/treasures.idx", huntId);
+
+    struct stat st;
+    if (stat(filePath, &st) == -1)
+    {
+        return -1;
+    }
+
+    int indexFd = open(indexPath, O_RDWR);
+    TreasureIndexHeader header;
+    if (indexFd == -1 ||
+        pread(indexFd, &header, sizeof(header), 0) != sizeof(header) ||
+        !headerMatches(&header, before))
+    {
+        if (indexFd != -1)
+        {
+            close(indexFd);
+        }
+        return rebuildTreasureIndex(huntId);
+    }
+
+    off_t at = sizeof(TreasureIndexHeader) + (off_t)header.entryCount * sizeof(TreasureIndexEntry);
+    pwrite(indexFd, entries, count * sizeof(TreasureIndexEntry), at);
+
+    fillHeader(&header, &st, header.entryCount + count, header.deletedCount);
+    pwrite(indexFd, &header, sizeof(header), 0);
+    close(indexFd);
+
+    return 0;
+}
+
+int markTreasureIndexDeleted(const char* huntId, const struct stat* before)
+{
+    char filePath[100];
+    char indexPath[100];
+    sprintf(filePath, "./%s/treasures", huntId);
+    sprintf(indexPath, "./%s/treasures.idx", huntId);
+
+    struct stat st;
+    if (stat(filePath, &st) == -1)
+    {
+        return -1;
+    }
+
+    //Offsets did not move, only the header needs to follow the new mtime
+    int indexFd = open(indexPath, O_RDWR);
+    TreasureIndexHeader header;
+    if (indexFd == -1 ||
+        pread(indexFd, &header, sizeof(header), 0) != sizeof(header) ||
+        !headerMatches(&header, before))
+    {
+        if (indexFd != -1)
+        {
+            close(indexFd);
+        }
+        return rebuildTreasureIndex(huntId);
+    }
+
+    fillHeader(&header, &st, header.entryCount, header.deletedCount + 1);
+    pwrite(indexFd, &header, sizeof(header), 0);
+    close(indexFd);
+
+    return 0;
+}
+
+int getTreasureIndexInfo(const char* huntId, TreasureIndexHeader* header, int* lastId)
+{
+    int indexFd = openFreshIndex(huntId, header);
+    if (indexFd == -1)
+    {
+        return -1;
+    }
+
+    TreasureIndexEntry entry;
+    *lastId = 0;
+    if (header->entryCount > 0 && readEntry(indexFd, header->entryCount - 1, &entry) == 0)
+    {
+        *lastId = entry.treasureId;
+    }
+    close(indexFd);
+
+    return 0;
+}
+
+int getTreasureOffsetAt(const char* huntId, int position, off_t* offset)
+{
+    TreasureIndexHeader header;
+    int indexFd = openFreshIndex(huntId, &header);
+    if (indexFd == -1)
+    {
+        return -1;
+    }
+
+    TreasureIndexEntry entry;
+    int result = -1;
+    if (position >= 0 && position < header.entryCount && readEntry(indexFd, position, &entry) == 0)
+    {
+        *offset = entry.offset;
+        result = 0;
+    }
+    close(indexFd);
+
+    return result;
+}
+
+int getTreasureIdsAt(const char* huntId, const int* positions, int count, int* treasureIds)
+{
+    TreasureIndexHeader header;
+    int indexFd = openFreshIndex(huntId, &header);
+    if (indexFd == -1)
+    {
+        return -1;
+    }
+
+    int result = 0;
+    TreasureIndexEntry entry;
+    for (int i = 0; i < count; i++)
+    {
+        if (positions[i] < 0 || positions[i] >= header.entryCount ||
+            readEntry(indexFd, positions[i], &entry) == -1)
+        {
+            result = -1;
+            break;
+        }
+        treasureIds[i] = entry.treasureId;
+    }
+    close(indexFd);
+
+    return result;
+}
@@ -0,0 +1,61 @@
+#ifndef TREASURE_INDEX_H
+#define TREASURE_INDEX_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define TREASURE_INDEX_MAGIC "TIDX"
+#define TREASURE_INDEX_VERSION 1
+
+//Header of the per-hunt index file (<hunt>/treasures.idx).
+//dataSize and the mtime fields describe the treasures file the index was
+//built from; any mismatch means the index is stale and gets rebuilt.
+typedef struct {
+    char magic[4];
+    int version;
+    int entryCount;
+    int deletedCount;
+    long long dataSize;
+    long long dataMtimeSec;
+    long long dataMtimeNsec;
+} TreasureIndexHeader;
+
+//One entry per record, in file order. IDs only ever grow along the file,
+//so entries are sorted by treasureId. Removed records keep their entry.
+typedef struct {
+    int treasureId;
+    int reserved;
+    long long offset;
+} TreasureIndexEntry;
+
+//Rebuild the index of a hunt from its treasures file
+int rebuildTreasureIndex(const char* huntId);
+
+//Find the byte offset of a treasure record.
+//Returns 1 if found, 0 if the hunt has no such ID, -1 on error.
+int findTreasureOffset(const char* huntId, int treasureId, off_t* offset);
+
+//Same lookup, also giving the record's position in file order (0-based)
+int findTreasurePosition(const char* huntId, int treasureId, int* position, off_t* offset);
+
+//Register records just appended to the treasures file. "before" is the
+//state of the treasures file before the append; if the index did not
+//match it, the whole index is rebuilt instead.
+int appendTreasureIndex(const char* huntId, const struct stat* before,
+                        const TreasureIndexEntry* entries, int count);
+
+//Record that the treasure at a known offset was tombstoned in place.
+//"before" is the state of the treasures file before the tombstone write.
+int markTreasureIndexDeleted(const char* huntId, const struct stat* before);
+
+//Read the (fresh) index header of a hunt and the highest ID ever stored
+int getTreasureIndexInfo(const char* huntId, TreasureIndexHeader* header, int* lastId);
+
+//Byte offset of the record at a position in file order (0-based)
+int getTreasureOffsetAt(const char* huntId, int position, off_t* offset);
+
+//Treasure IDs at several positions in file order; positions and
+//treasureIds may be the same array
+int getTreasureIdsAt(const char* huntId, const int* positions, int count, int* treasureIds);
+
+#endif
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "treasure_log.h"
+
+int parseLogSyncMode(const char* name, LogSyncMode* mode)
+{
+    if (strcmp(name, "none") == 0)
+    {
+        *mode = LOG_SYNC_NONE;
+    }
+    else if (strcmp(name, "batch") == 0)
+    {
+        *mode = LOG_SYNC_BATCH;
+    }
+    else if (strcmp(name, "entry") == 0)
+    {
+        *mode = LOG_SYNC_ENTRY;
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
+
+//Create the symlink to the hunt's log only if it is missing or points elsewhere
+static void ensureSymLink(const char* huntId)
+{
+    char logPath[100];
+    char linkPath[100];
+    char current[100];
+
+    sprintf(logPath, "./%s/logged_hunt", huntId);
+    sprintf(linkPath, "./logged_hunt-%s", huntId);
+
+    ssize_t length = readlink(linkPath, current, sizeof(current) - 1);
+    if (length >= 0)
+    {
+        current[length] = 0;
+        if (strcmp(current, logPath) == 0)
+        {
+            return;
+        }
+    }
+
+    //Remove existing symlink if it exists
+    unlink(linkPath);
+
+    //Create new symlink
+    if (symlink(logPath, linkPath) == -1)
+    {
+        perror("Failed to create symbolic link");
+    }
+}
+
+int openHuntLog(HuntLog* log, const char* huntId, LogSyncMode mode)
+{
+    char logPath[100];
+    sprintf(logPath, "./%s/logged_hunt", huntId);
+
+    log->length = 0;
+    log->mode = mode;
+    snprintf(log->huntId, sizeof(log->huntId), "%s", huntId);
+
+    log->fd = open(logPath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (log->fd == -1)
+    {
+        perror("Failed to open log file");
+        return -1;
+    }
+
+    ensureSymLink(huntId);
+    return 0;
+}
+
+void appendHuntLog(HuntLog* log, const char* entry)
+{
+    if (log->fd == -1)
+    {
+        return;
+    }
+
+    size_t length = strlen(entry);
+    if (log->length + length + 1 > sizeof(log->buffer))
+    {
+        flushHuntLog(log);
+    }
+
+    //An entry larger than the whole buffer goes straight out
+    if (length + 1 > sizeof(log->buffer))
+    {
+        write(log->fd, entry, length);
+        write(log->fd, "\n", 1);
+    }
+    else
+    {
+        memcpy(log->buffer + log->length, entry, length);
+        log->buffer[log->length + length] = '\n';
+        log->length += length + 1;
+    }
+
+    if (log->mode == LOG_SYNC_ENTRY)
+    {
+        flushHuntLog(log);
+    }
+}
+
+void flushHuntLog(HuntLog* log)
+{
+    if (log->fd == -1 || log->length == 0)
+    {
+        return;
+    }
+
+    if (write(log->fd, log->buffer, log->length) != (ssize_t)log->length)
+    {
+        perror("Failed to write log file");
+    }
+    log->length = 0;
+
+    if (log->mode != LOG_SYNC_NONE)
+    {
+        fdatasync(log->fd);
+    }
+}
+
+void closeHuntLog(HuntLog* log)
+{
+    if (log->fd == -1)
+    {
+        return;
+    }
+
+    flushHuntLog(log);
+    close(log->fd);
+    log->fd = -1;
+}
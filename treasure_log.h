@@ -0,0 +1,39 @@
+#ifndef TREASURE_LOG_H
+#define TREASURE_LOG_H
+
+#include <stddef.h>
+
+//How hard a hunt log tries to reach the disk
+typedef enum {
+    LOG_SYNC_NONE,   //leave it to the page cache
+    LOG_SYNC_BATCH,  //fdatasync once per flush
+    LOG_SYNC_ENTRY   //flush and fdatasync after every entry
+} LogSyncMode;
+
+#define HUNT_LOG_BUFFER 8192
+
+//Buffered writer for a hunt's logged_hunt file. The fd stays open while
+//the log is in use and entries are coalesced into one write per flush.
+typedef struct {
+    int fd;
+    char huntId[100];
+    LogSyncMode mode;
+    size_t length;
+    char buffer[HUNT_LOG_BUFFER];
+} HuntLog;
+
+//Parse "none", "batch" or "entry". Returns -1 for anything else.
+int parseLogSyncMode(const char* name, LogSyncMode* mode);
+
+//Open the log of a hunt and make sure its logged_hunt-<ID> symlink exists
+int openHuntLog(HuntLog* log, const char* huntId, LogSyncMode mode);
+
+//Queue one log line (the newline is added here)
+void appendHuntLog(HuntLog* log, const char* entry);
+
+//Write everything queued with a single write call
+void flushHuntLog(HuntLog* log);
+
+void closeHuntLog(HuntLog* log);
+
+#endif
@@ -6,16 +6,28 @@
 #include <sys/types.h>
 #include <time.h>
 #include <fcntl.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#include <math.h>
 
-//Structure treasure data
-typedef struct {
-    int treasureId;
-    char userName[50];
-    float latitude;
-    float longitude;
-    char clueText[200];
-    int value;
-} Treasure;
+#include "treasure.h"
+#include "treasure_index.h"
+#include "treasure_columns.h"
+#include "treasure_grid.h"
+#include "treasure_reader.h"
+#include "treasure_query.h"
+#include "treasure_output.h"
+#include "treasure_log.h"
+#include "hunt_meta.h"
+#include "score_cache.h"
+#include "treasure_stats.h"
+
+//Share of removed records above which --compact rewrites the hunt
+#define COMPACT_THRESHOLD 0.25
+
+//Records written per writev call by --add-batch (at most IOV_MAX)
+#define BATCH_RECORDS 1024
 
 //Creates hunt directory if it doesn't exist
 int createHuntDirectory(char* huntId) 
@@ -40,78 +52,120 @@ int createHuntDirectory(char* huntId)
     return 0;
 }
 
-//Create symbolic link to hunt's log file
-void createSymLink(char* huntId) 
+//Log of the hunt being worked on, kept open until the program ends
+HuntLog huntLog = { .fd = -1 };
+LogSyncMode logSyncMode = LOG_SYNC_NONE;
+
+//Output of --list and --view, set with --format=
+OutputFormat outputFormat = OUTPUT_TEXT;
+
+//Log operation
+void logOperation(char* huntId, char* operation) 
 {
-    char logPath[100];
-    char linkPath[100];
-    
-    sprintf(logPath, "./%s/logged_hunt", huntId);
-    sprintf(linkPath, "./logged_hunt-%s", huntId);
-    
-    //Remove existing symlink if it exists
-    unlink(linkPath);
-    
-    //Create new symlink
-    if (symlink(logPath, linkPath) == -1) 
+    //Reuse the open log, entries are flushed together on exit
+    if (huntLog.fd == -1 || strcmp(huntLog.huntId, huntId) != 0) 
     {
-        perror("Failed to create symbolic link");
+        closeHuntLog(&huntLog);
+        if (openHuntLog(&huntLog, huntId, logSyncMode) == -1) 
+        {
+            return;
+        }
     }
+    
+    appendHuntLog(&huntLog, operation);
 }
 
-//Log operation
-void logOperation(char* huntId, char* operation) 
+//Open a hunt's treasures file for writing. A new file gets its header,
+//a legacy file has to be converted with --migrate first.
+int openTreasureFileForWrite(char* huntId, int create, TreasureFileHeader* fileHeader)
 {
-    char logPath[100];
-    sprintf(logPath, "./%s/logged_hunt", huntId);
+    char filePath[100];
+    sprintf(filePath, "./%s/treasures", huntId);
     
-    int fd = open(logPath, O_WRONLY | O_CREAT | O_APPEND, 0644);
-    if (fd == -1) 
+    int fd = open(filePath, O_RDWR | (create ? O_CREAT : 0), 0644);
+    if (fd == -1)
     {
-        perror("Failed to open log file");
-        return;
+        perror("Failed to open treasure file");
+        return -1;
     }
     
-    //Create log entry
-    char logEntry[300];
-    sprintf(logEntry, "%s\n", operation);
-    
-    //Write to log file
-    write(fd, logEntry, strlen(logEntry));
-    close(fd);
+    int version = readTreasureFileHeader(fd, fileHeader);
+    if (version == 0) 
+    {
+        initTreasureFileHeader(fileHeader);
+        if (writeTreasureFileHeader(fd, fileHeader) == -1) 
+        {
+            perror("Failed to write treasure file header");
+            close(fd);
+            return -1;
+        }
+        
+        //A new file has to survive a crash along with its directory entry
+        fdatasync(fd);
+        syncHuntDirectory(huntId);
+    }
+    else if (version == 1) 
+    {
+        printf("Hunt %s uses the old file format, run --migrate %s first\n", huntId, huntId);
+        close(fd);
+        return -1;
+    }
+    else if (version == -1) 
+    {
+        perror("Failed to read treasure file");
+        close(fd);
+        return -1;
+    }
     
-    //Create symlink
-    createSymLink(huntId);
+    return fd;
 }
 
-//Add treasure to the specified hunt
-void addTreasure(char* huntId) 
+//Second descriptor on a treasures file for records. O_APPEND keeps every
+//write at the end of the file; the header goes through the O_RDWR
+//descriptor, as pwrite on an O_APPEND descriptor appends on Linux.
+int openTreasureFileForAppend(char* huntId)
 {
-    if (createHuntDirectory(huntId) == -1)
-    {
-        return;
-    }
-    
-    //Prepare treasure file path
     char filePath[100];
     sprintf(filePath, "./%s/treasures", huntId);
     
-    //Open treasure file
-    int fd = open(filePath, O_RDWR | O_CREAT, 0644);
+    int fd = open(filePath, O_WRONLY | O_APPEND);
     if (fd == -1)
     {
         perror("Failed to open treasure file");
-        return;
     }
+    return fd;
+}
+
+//Stamp a score cache that followed a change with the state just committed
+//under the lock, or drop the cache when it could not follow; the next
+//score_calculator run rebuilds it
+void storeScoreCache(char* huntId, HuntLock* lock, ScoreCache* cache, int applied)
+{
+    char filePath[100];
+    sprintf(filePath, "./%s/treasures", huntId);
     
-    //Get number of treasures
     struct stat st;
-    fstat(fd, &st);
-    int treasureCount = st.st_size / sizeof(Treasure);
+    if (!applied || stat(filePath, &st) == -1 ||
+        saveScoreCache(huntId, lock->meta.sequence, &st, cache) == -1)
+    {
+        sprintf(filePath, "./%s/scores.cache", huntId);
+        unlink(filePath);
+    }
+    freeScoreCache(cache);
+}
+
+//Add treasure to the specified hunt
+void addTreasure(char* huntId) 
+{
+    if (createHuntDirectory(huntId) == -1)
+    {
+        return;
+    }
     
-    //Create new treasure
+    //Create new treasure; the input is read before the hunt is locked so
+    //a slow typist never holds up other writers
     Treasure newTreasure;
-    newTreasure.treasureId = treasureCount + 1;
+    memset(&newTreasure, 0, sizeof(newTreasure));
     
     printf("Enter username: ");
     scanf("%s", newTreasure.userName);
@@ -121,6 +175,11 @@ void addTreasure(char* huntId)
     
     printf("Enter longitude: ");
     scanf("%f", &newTreasure.longitude);
+    if (!isfinite(newTreasure.latitude) || !isfinite(newTreasure.longitude))
+    {
+        printf("Invalid location, latitude and longitude must be numbers\n");
+        return;
+    }
     
     printf("Enter clue text: ");
     getchar();
@@ -131,11 +190,75 @@ void addTreasure(char* huntId)
     printf("Enter value: ");
     scanf("%d", &newTreasure.value);
     
-    //Move to end of file and write new treasure
-    lseek(fd, 0, SEEK_END);
-    write(fd, &newTreasure, sizeof(Treasure));
+    //Everything from opening the file to updating the sidecars happens
+    //under the hunt lock
+    HuntLock lock;
+    if (lockHunt(huntId, &lock) == -1)
+    {
+        return;
+    }
+    
+    TreasureFileHeader fileHeader;
+    int fd = openTreasureFileForWrite(huntId, 1, &fileHeader);
+    int appendFd = fd == -1 ? -1 : openTreasureFileForAppend(huntId);
+    if (appendFd == -1)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        unlockHunt(&lock);
+        return;
+    }
+    
+    //IDs come from the hunt's counter, so removed or compacted-away IDs
+    //are never handed out again
+    struct stat st;
+    fstat(appendFd, &st);
+    TreasureIndexHeader header;
+    int lastId = 0;
+    getTreasureIndexInfo(huntId, &header, &lastId);
+    newTreasure.treasureId = nextTreasureId(&lock, lastId);
+    
+    //The score cache has to match the hunt as it was before the append
+    long long sequence = lock.meta.sequence;
+    
+    //Append the new treasure
+    TreasureIndexEntry entry;
+    entry.treasureId = newTreasure.treasureId;
+    entry.reserved = 0;
+    entry.offset = st.st_size;
+    
+    unsigned char record[TREASURE_RECORD_MAX];
+    size_t length = encodeTreasure(&newTreasure, record);
+    if (write(appendFd, record, length) != (ssize_t)length || fdatasync(appendFd) == -1) 
+    {
+        perror("Failed to write treasure");
+        close(appendFd);
+        close(fd);
+        unlockHunt(&lock);
+        return;
+    }
+    close(appendFd);
+    
+    fileHeader.recordCount++;
+    writeTreasureFileHeader(fd, &fileHeader);
     close(fd);
     
+    //Keep the ID index, the columns and the grid in step with the file
+    TreasureGridEntry gridEntry = { newTreasure.treasureId, newTreasure.latitude,
+                                    newTreasure.longitude, 0, entry.offset };
+    appendTreasureIndex(huntId, &st, &entry, 1);
+    appendTreasureColumns(huntId, &st, &newTreasure, 1);
+    appendTreasureGrid(huntId, &st, &gridEntry, 1);
+    commitHunt(&lock, huntId);
+    ScoreCache cache;
+    if (loadScoreCache(huntId, sequence, &st, &cache) == 0)
+    {
+        storeScoreCache(huntId, &lock, &cache, scoreCacheAdd(&cache, &newTreasure) == 0);
+    }
+    unlockHunt(&lock);
+    
     //Log operation
     char operation[100];
     sprintf(operation, "Added treasure %d to hunt %s", newTreasure.treasureId, huntId);
@@ -144,9 +267,281 @@ void addTreasure(char* huntId)
     printf("Treasure added successfully with ID: %d\n", newTreasure.treasureId);
 }
 
-//List all treasures in a hunt
-void listTreasures(char* huntId) 
+//Parse one "user,latitude,longitude,value,clue" line (tabs work as well as
+//commas). The clue is the last field, so it may contain the delimiter.
+int parseTreasureLine(char* line, Treasure* treasure)
+{
+    char delimiter = strchr(line, '\t') != NULL ? '\t' : ',';
+    char* fields[5];
+    
+    line[strcspn(line, "\r\n")] = 0;
+    for (int i = 0; i < 4; i++) 
+    {
+        fields[i] = line;
+        line = strchr(line, delimiter);
+        if (line == NULL) 
+        {
+            return -1;
+        }
+        *line++ = 0;
+    }
+    fields[4] = line;
+    
+    //Basic validation before anything reaches the file
+    char* end;
+    memset(treasure, 0, sizeof(Treasure));
+    if (fields[0][0] == 0 || strlen(fields[0]) >= sizeof(treasure->userName) ||
+        strlen(fields[4]) >= sizeof(treasure->clueText)) 
+    {
+        return -1;
+    }
+    strcpy(treasure->userName, fields[0]);
+    strcpy(treasure->clueText, fields[4]);
+    
+    treasure->latitude = strtof(fields[1], &end);
+    if (end == fields[1] || *end != 0) 
+    {
+        return -1;
+    }
+    treasure->longitude = strtof(fields[2], &end);
+    if (end == fields[2] || *end != 0) 
+    {
+        return -1;
+    }
+    if (!isfinite(treasure->latitude) || !isfinite(treasure->longitude)) 
+    {
+        return -1;
+    }
+    treasure->value = strtol(fields[3], &end, 10);
+    if (end == fields[3] || *end != 0) 
+    {
+        return -1;
+    }
+    
+    return 0;
+}
+
+//Add many treasures read from a CSV/TSV file or stdin ("-") with one open,
+//batched writev calls and a single log entry
+void addTreasureBatch(char* huntId, char* inputPath)
+{
+    FILE* input = stdin;
+    if (strcmp(inputPath, "-") != 0) 
+    {
+        input = fopen(inputPath, "r");
+        if (input == NULL) 
+        {
+            perror("Failed to open batch file");
+            return;
+        }
+    }
+    
+    if (createHuntDirectory(huntId) == -1)
+    {
+        if (input != stdin) 
+        {
+            fclose(input);
+        }
+        return;
+    }
+    
+    //The hunt stays locked for the whole import
+    HuntLock lock;
+    TreasureFileHeader fileHeader;
+    int fd = -1;
+    int appendFd = -1;
+    if (lockHunt(huntId, &lock) == 0 &&
+        (fd = openTreasureFileForWrite(huntId, 1, &fileHeader)) != -1)
+    {
+        appendFd = openTreasureFileForAppend(huntId);
+    }
+    if (appendFd == -1)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        unlockHunt(&lock);
+        if (input != stdin) 
+        {
+            fclose(input);
+        }
+        return;
+    }
+    
+    struct stat st;
+    fstat(appendFd, &st);
+    TreasureIndexHeader header;
+    int lastId = 0;
+    getTreasureIndexInfo(huntId, &header, &lastId);
+    
+    //The grid is rewritten to add entries, so that happens once, for the
+    //whole import, against the file as it was before it
+    struct stat started = st;
+    TreasureGridEntry* gridEntries = NULL;
+    int gridCount = 0;
+    int gridCapacity = 0;
+    int gridFailed = 0;
+    
+    //A fresh score cache follows the import in memory and is written once
+    //at the end
+    ScoreCache cache;
+    int cached = loadScoreCache(huntId, lock.meta.sequence, &st, &cache) == 0;
+    int cacheApplied = 1;
+    
+    static unsigned char batch[BATCH_RECORDS * TREASURE_RECORD_MAX];
+    static TreasureIndexEntry entries[BATCH_RECORDS];
+    static Treasure treasures[BATCH_RECORDS];
+    struct iovec iov[BATCH_RECORDS];
+    size_t batchBytes = 0;
+    int batchCount = 0;
+    Treasure treasure;
+    
+    off_t offset = st.st_size;
+    int firstId = 0;
+    int added = 0;
+    int lineNumber = 0;
+    int skipped = 0;
+    char* line = NULL;
+    size_t lineSize = 0;
+    
+    while (1) 
+    {
+        int endOfInput = getline(&line, &lineSize, input) == -1;
+        
+        if (!endOfInput) 
+        {
+            lineNumber++;
+            
+            //Skip blank lines and comments
+            if (line[strspn(line, " \t\r\n")] == 0 || line[0] == '#') 
+            {
+                continue;
+            }
+            
+            if (parseTreasureLine(line, &treasure) == -1) 
+            {
+                printf("Skipping invalid line %d\n", lineNumber);
+                skipped++;
+                continue;
+            }
+            
+            treasure.treasureId = nextTreasureId(&lock, lastId);
+            if (firstId == 0) 
+            {
+                firstId = treasure.treasureId;
+            }
+            size_t length = encodeTreasure(&treasure, batch + batchBytes);
+            entries[batchCount].treasureId = treasure.treasureId;
+            entries[batchCount].reserved = 0;
+            entries[batchCount].offset = offset;
+            treasures[batchCount] = treasure;
+            offset += length;
+            
+            iov[batchCount].iov_base = batch + batchBytes;
+            iov[batchCount].iov_len = length;
+            batchBytes += length;
+            batchCount++;
+        }
+        
+        //Flush a full batch, or whatever is left at the end of the input
+        if (batchCount == BATCH_RECORDS || (endOfInput && batchCount > 0)) 
+        {
+            //One data sync and one commit per batch, not per record
+            if (writev(appendFd, iov, batchCount) != (ssize_t)batchBytes ||
+                fdatasync(appendFd) == -1) 
+            {
+                perror("Failed to write treasures");
+                break;
+            }
+            
+            fileHeader.recordCount += batchCount;
+            writeTreasureFileHeader(fd, &fileHeader);
+            
+            //The index and columns follow batch by batch, st tracks the file they describe
+            appendTreasureIndex(huntId, &st, entries, batchCount);
+            appendTreasureColumns(huntId, &st, treasures, batchCount);
+            commitHunt(&lock, huntId);
+            fstat(appendFd, &st);
+            for (int i = 0; i < batchCount && cached && cacheApplied; i++) 
+            {
+                cacheApplied = scoreCacheAdd(&cache, &treasures[i]) == 0;
+            }
+            if (!gridFailed && gridCount + batchCount > gridCapacity) 
+            {
+                int capacity = gridCapacity ? gridCapacity * 2 : BATCH_RECORDS;
+                TreasureGridEntry* grown = realloc(gridEntries, capacity * sizeof(TreasureGridEntry));
+                gridFailed = grown == NULL;
+                if (!gridFailed) 
+                {
+                    gridEntries = grown;
+                    gridCapacity = capacity;
+                }
+            }
+            for (int i = 0; i < batchCount && !gridFailed; i++) 
+            {
+                TreasureGridEntry gridEntry = { treasures[i].treasureId, treasures[i].latitude,
+                                                treasures[i].longitude, 0, entries[i].offset };
+                gridEntries[gridCount++] = gridEntry;
+            }
+            added += batchCount;
+            batchBytes = 0;
+            batchCount = 0;
+        }
+        
+        if (endOfInput) 
+        {
+            break;
+        }
+    }
+    
+    free(line);
+    close(appendFd);
+    close(fd);
+    if (added > 0)
+    {
+        if (gridFailed)
+        {
+            rebuildTreasureGrid(huntId);
+        }
+        else
+        {
+            appendTreasureGrid(huntId, &started, gridEntries, gridCount);
+        }
+    }
+    free(gridEntries);
+    if (cached)
+    {
+        storeScoreCache(huntId, &lock, &cache, cacheApplied);
+    }
+    unlockHunt(&lock);
+    if (input != stdin) 
+    {
+        fclose(input);
+    }
+    
+    if (added > 0) 
+    {
+        //Log operation
+        char operation[150];
+        sprintf(operation, "Added %d treasures (IDs %d-%d) to hunt %s in one batch",
+                added, firstId, firstId + added - 1, huntId);
+        logOperation(huntId, operation);
+    }
+    
+    printf("Added %d treasures to hunt %s, skipped %d invalid lines\n", added, huntId, skipped);
+}
+
+//List the treasures in a hunt that match a query
+void listTreasures(char* huntId, TreasureQuery* query) 
 {
+    //Records leave in large writes instead of one per line
+    setvbuf(stdout, NULL, _IOFBF, TREASURE_QUERY_BUFFER);
+    
+    //Machine-readable output keeps stdout for the data alone
+    int text = query->format == OUTPUT_TEXT;
+    FILE* messages = text ? stdout : stderr;
+    
     char filePath[100];
     sprintf(filePath, "./%s/treasures", huntId);
     
@@ -154,45 +549,36 @@ void listTreasures(char* huntId)
     struct stat st;
     if (stat(filePath, &st) == -1)
      {
-        printf("Hunt not found: %s\n", huntId);
+        fprintf(messages, "Hunt not found: %s\n", huntId);
         return;
     }
     
-    //Open treasure file
-    int fd = open(filePath, O_RDONLY);
-    if (fd == -1)
+    //Map treasure file
+    TreasureReader reader;
+    if (openTreasureReader(&reader, filePath) == -1)
      {
         perror("Failed to open treasure file");
         return;
     }
     
     //Print hunt info
-    printf("Hunt: %s\n", huntId);
-    printf("File size: %lld bytes\n", st.st_size);
-    
-    //Read and print all treasures
-    Treasure treasure;
-    printf("Treasures in hunt %s:\n", huntId);
-    printf("-------------------\n");
-    
-    int treasureCount = 0;
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure))
-     {
-        printf("ID: %d\n", treasure.treasureId);
-        printf("User: %s\n", treasure.userName);
-        printf("Location: %.6f, %.6f\n", treasure.latitude, treasure.longitude);
-        printf("Clue: %s\n", treasure.clueText);
-        printf("Value: %d\n", treasure.value);
+    if (text) 
+    {
+        printf("Hunt: %s\n", huntId);
+        printf("File size: %lld bytes\n", (long long)st.st_size);
+        printf("Treasures in hunt %s:\n", huntId);
         printf("-------------------\n");
-        treasureCount++;
     }
     
-    if (treasureCount == 0)
+    //Read and print the matching treasures
+    long treasureCount = printTreasureQuery(stdout, &reader, huntId, query);
+    
+    if (treasureCount == 0 && text)
      {
         printf("No treasures found in this hunt.\n");
     }
     
-    close(fd);
+    closeTreasureReader(&reader);
     
     //Log operation
     char operation[100];
@@ -200,9 +586,12 @@ void listTreasures(char* huntId)
     logOperation(huntId, operation);
 }
 
-//View details of a specific treasure
-void viewTreasure(char* huntId) 
+//View details of a specific treasure, asking for its ID unless given
+void viewTreasure(char* huntId, char* treasureIdStr) 
 {
+    //Machine-readable output keeps stdout for the data alone
+    FILE* messages = outputFormat == OUTPUT_TEXT ? stdout : stderr;
+    
     char filePath[100];
     sprintf(filePath, "./%s/treasures", huntId);
     
@@ -210,47 +599,70 @@ void viewTreasure(char* huntId)
     struct stat st;
     if (stat(filePath, &st) == -1) 
     {
-        printf("Hunt not found: %s\n", huntId);
+        fprintf(messages, "Hunt not found: %s\n", huntId);
         return;
     }
     
-    //Open treasure file
-    int fd = open(filePath, O_RDONLY);
-    if (fd == -1) 
+    //Map treasure file
+    TreasureReader reader;
+    if (openTreasureReader(&reader, filePath) == -1) 
     {
         perror("Failed to open treasure file");
         return;
     }
     
     //Ask for treasure ID
-    int treasureId;
-    printf("Enter treasure ID to view: ");
-    scanf("%d", &treasureId);
+    int treasureId = 0;
+    if (treasureIdStr != NULL) 
+    {
+        treasureId = atoi(treasureIdStr);
+    }
+    else 
+    {
+        fprintf(messages, "Enter treasure ID to view: ");
+        fflush(messages);
+        scanf("%d", &treasureId);
+    }
     
-    //Find and display the treasure
-    Treasure treasure;
+    //Seek straight to the treasure using the ID index
+    const Treasure* treasure;
     int found = 0;
+    off_t offset;
     
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure)) 
+    if (findTreasureOffset(huntId, treasureId, &offset) == 1 &&
+        (treasure = treasureAt(&reader, offset)) != NULL) 
     {
-        if (treasure.treasureId == treasureId) {
-            printf("\nTreasure Details:\n");
-            printf("ID: %d\n", treasure.treasureId);
-            printf("User: %s\n", treasure.userName);
-            printf("Location: %.6f, %.6f\n", treasure.latitude, treasure.longitude);
-            printf("Clue: %s\n", treasure.clueText);
-            printf("Value: %d\n", treasure.value);
+        if (treasure->treasureId == treasureId) {
+            if (outputFormat == OUTPUT_TEXT) 
+            {
+                printf("\nTreasure Details:\n");
+                printf("ID: %d\n", treasure->treasureId);
+                printf("User: %s\n", treasure->userName);
+                printf("Location: %.6f, %.6f\n", treasure->latitude, treasure->longitude);
+                printf("Clue: %s\n", treasure->clueText);
+                printf("Value: %d\n", treasure->value);
+            }
+            else if (outputFormat == OUTPUT_BINARY) 
+            {
+                writeTreasureRecord(stdout, treasure);
+            }
+            else 
+            {
+                char json[TREASURE_JSON_MAX + 1];
+                size_t length = formatTreasureJson(treasure, json);
+                json[length++] = '\n';
+                fwrite(json, 1, length, stdout);
+            }
             found = 1;
-            break;
         }
     }
     
     if (!found) 
     {
-        printf("Treasure with ID %d not found in hunt %s\n", treasureId, huntId);
+        fprintf(messages, "Treasure with ID %d not found in hunt %s\n", treasureId, huntId);
     }
     
-    close(fd);
+    closeTreasureReader(&reader);
     
     //Log operation
     if (found) 
@@ -261,7 +673,83 @@ void viewTreasure(char* huntId)
     }
 }
 
-//Remove a treasure from a hunt
+//Print the treasures a grid query matched, reading each record by offset
+void printGridMatches(char* huntId, TreasureGridMatch* matches, int count, int withDistance)
+{
+    char filePath[100];
+    sprintf(filePath, "./%s/treasures", huntId);
+    
+    TreasureReader reader;
+    if (openTreasureReader(&reader, filePath) == -1) 
+    {
+        perror("Failed to open treasure file");
+        return;
+    }
+    
+    printf("-------------------\n");
+    int shown = 0;
+    for (int i = 0; i < count; i++) 
+    {
+        const Treasure* treasure = treasureAt(&reader, matches[i].entry.offset);
+        if (treasure == NULL || TREASURE_IS_DELETED(treasure)) 
+        {
+            continue;
+        }
+        
+        printf("ID: %d\n", treasure->treasureId);
+        printf("User: %s\n", treasure->userName);
+        printf("Location: %.6f, %.6f\n", treasure->latitude, treasure->longitude);
+        if (withDistance) 
+        {
+            printf("Distance: %.0f m\n", matches[i].distance);
+        }
+        printf("Clue: %s\n", treasure->clueText);
+        printf("Value: %d\n", treasure->value);
+        printf("-------------------\n");
+        shown++;
+    }
+    
+    if (shown == 0) 
+    {
+        printf("No treasures found.\n");
+    }
+    
+    closeTreasureReader(&reader);
+}
+
+//List treasures within radius metres of a point, nearest first
+void nearTreasures(char* huntId, char* latitude, char* longitude, char* radius)
+{
+    TreasureGridMatch* matches;
+    int count = findTreasuresNear(huntId, atof(latitude), atof(longitude), atof(radius), &matches);
+    if (count == -1) 
+    {
+        printf("Hunt not found: %s\n", huntId);
+        return;
+    }
+    
+    printf("Treasures in hunt %s within %s m of %s, %s:\n", huntId, radius, latitude, longitude);
+    printGridMatches(huntId, matches, count, 1);
+    free(matches);
+}
+
+//List treasures inside a latitude/longitude box, by ID
+void boxTreasures(char* huntId, char* minLat, char* minLon, char* maxLat, char* maxLon)
+{
+    TreasureGridMatch* matches;
+    int count = findTreasuresInBox(huntId, atof(minLat), atof(minLon), atof(maxLat), atof(maxLon), &matches);
+    if (count == -1) 
+    {
+        printf("Hunt not found: %s\n", huntId);
+        return;
+    }
+    
+    printf("Treasures in hunt %s between %s, %s and %s, %s:\n", huntId, minLat, minLon, maxLat, maxLon);
+    printGridMatches(huntId, matches, count, 0);
+    free(matches);
+}
+
+//Remove a treasure from a hunt by tombstoning its record in place
 void removeTreasure(char* huntId, char* treasureIdStr)
 {
     char filePath[100];
@@ -277,61 +765,303 @@ void removeTreasure(char* huntId, char* treasureIdStr)
     
     int treasureId = atoi(treasureIdStr);
     
-    //Open treasure file
-    int fd = open(filePath, O_RDWR);
+    //Lock the hunt, then open treasure file
+    HuntLock lock;
+    if (lockHunt(huntId, &lock) == -1)
+    {
+        return;
+    }
+    TreasureFileHeader fileHeader;
+    int fd = openTreasureFileForWrite(huntId, 0, &fileHeader);
     if (fd == -1)
      {
-        perror("Failed to open treasure file");
+        unlockHunt(&lock);
+        return;
+    }
+    
+    //Locate the record through the ID index before touching anything.
+    //A record that is already tombstoned decodes with a negated ID.
+    off_t removeOffset;
+    int position;
+    unsigned char record[TREASURE_RECORD_MAX];
+    Treasure treasure;
+    ssize_t got;
+    if (findTreasurePosition(huntId, treasureId, &position, &removeOffset) != 1 ||
+        (got = pread(fd, record, sizeof(record), removeOffset)) <= 0 ||
+        decodeTreasure(record, got, &treasure) == 0 ||
+        treasure.treasureId != treasureId) 
+    {
+        printf("Treasure with ID %d not found in hunt %s\n", treasureId, huntId);
+        close(fd);
+        unlockHunt(&lock);
+        return;
+    }
+    
+    //Mark as deleted with a single one-byte write, other records keep their IDs and offsets
+    fstat(fd, &st);
+    long long sequence = lock.meta.sequence;
+    unsigned char flags = record[TREASURE_RECORD_FLAGS_AT] | TREASURE_RECORD_DELETED;
+    if (pwrite(fd, &flags, 1, removeOffset + TREASURE_RECORD_FLAGS_AT) != 1 || fdatasync(fd) == -1) 
+    {
+        perror("Failed to remove treasure");
+        close(fd);
+        unlockHunt(&lock);
         return;
     }
+    close(fd);
+    
+    markTreasureIndexDeleted(huntId, &st);
+    markTreasureColumnsDeleted(huntId, &st, position);
+    markTreasureGridDeleted(huntId, &st, treasureId, treasure.latitude, treasure.longitude);
+    commitHunt(&lock, huntId);
+    ScoreCache cache;
+    if (loadScoreCache(huntId, sequence, &st, &cache) == 0)
+    {
+        storeScoreCache(huntId, &lock, &cache, scoreCacheRemove(&cache, &treasure) == 0);
+    }
+    unlockHunt(&lock);
+    
+    printf("Treasure with ID %d removed from hunt %s\n", treasureId, huntId);
+    
+    //Log operation
+    char operation[100];
+    sprintf(operation, "Removed treasure %d from hunt %s", treasureId, huntId);
+    logOperation(huntId, operation);
+}
+
+//Write every record of reader into a fresh file in the current format and
+//swap it in. Removed records are dropped when dropRemoved is set.
+//Returns the number of records written, or -1 on error.
+int rewriteTreasureFile(char* huntId, TreasureReader* reader, int dropRemoved)
+{
+    char filePath[100];
+    char tempPath[TREASURE_TEMP_PATH_MAX];
+    sprintf(filePath, "./%s/treasures", huntId);
     
     //Create a temporary file
-    char tempPath[100];
-    sprintf(tempPath, "./%s/treasures.tmp", huntId);
-    int tempFd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int tempFd = createTempFile(filePath, tempPath);
     if (tempFd == -1) 
     {
         perror("Failed to create temporary file");
-        close(fd);
-        return;
+        return -1;
     }
     
-    //Find and remove the treasure
-    Treasure treasure;
-    int found = 0;
-    int newId = 1;
+    //Records go out through a large buffer, the header is filled in at the end
+    static unsigned char buffer[65536];
+    size_t buffered = TREASURE_HEADER_SIZE;
+    memset(buffer, 0, TREASURE_HEADER_SIZE);
     
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure))
-     {
-        if (treasure.treasureId == treasureId) 
+    TreasureFileHeader fileHeader;
+    initTreasureFileHeader(&fileHeader);
+    
+    const Treasure* treasure;
+    int failed = 0;
+    while ((treasure = nextTreasure(reader)) != NULL && !failed) 
+    {
+        if (dropRemoved && TREASURE_IS_DELETED(treasure)) 
         {
-            found = 1;
             continue;
         }
         
-        treasure.treasureId = newId++;
-        write(tempFd, &treasure, sizeof(Treasure));
+        if (buffered + TREASURE_RECORD_MAX > sizeof(buffer)) 
+        {
+            failed = write(tempFd, buffer, buffered) != (ssize_t)buffered;
+            buffered = 0;
+        }
+        buffered += encodeTreasure(treasure, buffer + buffered);
+        fileHeader.recordCount++;
     }
     
-    close(fd);
+    if (!failed && write(tempFd, buffer, buffered) != (ssize_t)buffered) 
+    {
+        failed = 1;
+    }
+    if (!failed && writeTreasureFileHeader(tempFd, &fileHeader) == -1) 
+    {
+        failed = 1;
+    }
+    
+    //The new file must be on disk before the rename can expose it
+    if (!failed && fsync(tempFd) == -1) 
+    {
+        failed = 1;
+    }
     close(tempFd);
     
-    if (!found) 
+    if (failed) 
     {
-        printf("Treasure with ID %d not found in hunt %s\n", treasureId, huntId);
-        unlink(tempPath);  //Remove temp file
-        return;
+        perror("Failed to write temporary file");
+        unlink(tempPath);
+        return -1;
     }
     
     //Replace original file with temp file
-    unlink(filePath);
-    rename(tempPath, filePath);
+    if (rename(tempPath, filePath) == -1) 
+    {
+        perror("Failed to replace treasure file");
+        unlink(tempPath);
+        return -1;
+    }
+    syncHuntDirectory(huntId);
+    rebuildTreasureIndex(huntId);
+    rebuildTreasureColumns(huntId);
+    rebuildTreasureGrid(huntId);
     
-    printf("Treasure with ID %d removed from hunt %s\n", treasureId, huntId);
+    return fileHeader.recordCount;
+}
+
+//Rewrite a hunt without its removed treasures once enough of them piled up
+void compactHunt(char* huntId)
+{
+    char filePath[100];
+    sprintf(filePath, "./%s/treasures", huntId);
+    
+    //Check if hunt exists
+    struct stat st;
+    if (stat(filePath, &st) == -1) 
+    {
+        printf("Hunt not found: %s\n", huntId);
+        return;
+    }
+    
+    //Writers wait while the file is swapped, so no append is lost to the rename
+    HuntLock lock;
+    if (lockHunt(huntId, &lock) == -1)
+    {
+        return;
+    }
+    
+    //The index keeps the tombstone count, so the check costs no scan
+    TreasureIndexHeader header;
+    int lastId;
+    if (getTreasureIndexInfo(huntId, &header, &lastId) == -1) 
+    {
+        printf("Failed to read index of hunt %s\n", huntId);
+        unlockHunt(&lock);
+        return;
+    }
+    
+    if (header.entryCount == 0 || header.deletedCount < header.entryCount * COMPACT_THRESHOLD) 
+    {
+        printf("Hunt %s does not need compaction (%d of %d treasures removed)\n",
+               huntId, header.deletedCount, header.entryCount);
+        unlockHunt(&lock);
+        return;
+    }
+    
+    //Map treasure file
+    TreasureReader reader;
+    if (openTreasureReader(&reader, filePath) == -1)
+     {
+        perror("Failed to open treasure file");
+        unlockHunt(&lock);
+        return;
+    }
+    
+    if (reader.version != TREASURE_FORMAT_VERSION) 
+    {
+        printf("Hunt %s uses the old file format, run --migrate %s first\n", huntId, huntId);
+        closeTreasureReader(&reader);
+        unlockHunt(&lock);
+        return;
+    }
+    
+    //Copy live treasures, IDs are kept as they are. The counter remembers
+    //the highest ID even if its record is dropped here.
+    seedTreasureIds(&lock, lastId);
+    long long sequence = lock.meta.sequence;
+    fstat(reader.fd, &st);
+    int kept = rewriteTreasureFile(huntId, &reader, 1);
+    closeTreasureReader(&reader);
+    if (kept != -1) 
+    {
+        //Only removed records went away, so the scores carry over as they are
+        commitHunt(&lock, huntId);
+        ScoreCache cache;
+        if (loadScoreCache(huntId, sequence, &st, &cache) == 0)
+        {
+            storeScoreCache(huntId, &lock, &cache, 1);
+        }
+    }
+    unlockHunt(&lock);
+    if (kept == -1) 
+    {
+        return;
+    }
+    
+    printf("Hunt %s compacted: %d treasures kept, %d removed records dropped\n",
+           huntId, kept, header.entryCount - kept);
     
     //Log operation
     char operation[100];
-    sprintf(operation, "Removed treasure %d from hunt %s", treasureId, huntId);
+    sprintf(operation, "Compacted hunt %s", huntId);
+    logOperation(huntId, operation);
+}
+
+//Convert a hunt written as raw Treasure structs to the current file format
+void migrateHunt(char* huntId)
+{
+    char filePath[100];
+    sprintf(filePath, "./%s/treasures", huntId);
+    
+    struct stat st;
+    HuntLock lock;
+    if (stat(filePath, &st) == -1) 
+    {
+        printf("Hunt not found: %s\n", huntId);
+        return;
+    }
+    if (lockHunt(huntId, &lock) == -1)
+    {
+        return;
+    }
+    
+    //Map treasure file
+    TreasureReader reader;
+    if (openTreasureReader(&reader, filePath) == -1)
+     {
+        printf("Hunt not found: %s\n", huntId);
+        unlockHunt(&lock);
+        return;
+    }
+    
+    if (reader.version == TREASURE_FORMAT_VERSION) 
+    {
+        printf("Hunt %s already uses file format version %d\n", huntId, TREASURE_FORMAT_VERSION);
+        closeTreasureReader(&reader);
+        unlockHunt(&lock);
+        return;
+    }
+    
+    //Removed records are carried over as tombstones, --compact drops them
+    off_t oldSize = reader.fileSize;
+    long long sequence = lock.meta.sequence;
+    fstat(reader.fd, &st);
+    int converted = rewriteTreasureFile(huntId, &reader, 0);
+    closeTreasureReader(&reader);
+    if (converted != -1) 
+    {
+        //Same treasures in a new encoding, the scores carry over
+        commitHunt(&lock, huntId);
+        ScoreCache cache;
+        if (loadScoreCache(huntId, sequence, &st, &cache) == 0)
+        {
+            storeScoreCache(huntId, &lock, &cache, 1);
+        }
+    }
+    unlockHunt(&lock);
+    if (converted == -1) 
+    {
+        return;
+    }
+    
+    stat(filePath, &st);
+    printf("Hunt %s migrated to format version %d: %d treasures, %lld -> %lld bytes\n",
+           huntId, TREASURE_FORMAT_VERSION, converted, (long long)oldSize, (long long)st.st_size);
+    
+    //Log operation
+    char operation[100];
+    sprintf(operation, "Migrated hunt %s to format version %d", huntId, TREASURE_FORMAT_VERSION);
     logOperation(huntId, operation);
 }
 
@@ -349,15 +1079,65 @@ void removeHunt(char* huntId)
         return;
     }
     
+    //Wait for writers to finish; the lock goes away with the metadata file
+    HuntLock lock;
+    if (lockHunt(huntId, &lock) == -1)
+    {
+        return;
+    }
+    
     //Remove treasure file
     char filePath[100];
     sprintf(filePath, "./%s/treasures", huntId);
     unlink(filePath);
     
+    //Remove the leftover compaction file of older versions
+    sprintf(filePath, "./%s/treasures.tmp", huntId);
+    unlink(filePath);
+    
+    //Remove temp files of rebuilds that never reached their rename
+    DIR* dir = opendir(dirPath);
+    struct dirent* entry;
+    while (dir != NULL && (entry = readdir(dir)) != NULL) 
+    {
+        if (strstr(entry->d_name, ".tmp.") != NULL &&
+            snprintf(filePath, sizeof(filePath), "./%s/%s", huntId, entry->d_name) < (int)sizeof(filePath)) 
+        {
+            unlink(filePath);
+        }
+    }
+    if (dir != NULL) 
+    {
+        closedir(dir);
+    }
+    
+    //Remove ID index and spatial grid
+    sprintf(filePath, "./%s/treasures.idx", huntId);
+    unlink(filePath);
+    sprintf(filePath, "./%s/treasures.grid", huntId);
+    unlink(filePath);
+    
+    //Remove score cache
+    sprintf(filePath, "./%s/scores.cache", huntId);
+    unlink(filePath);
+    
+    //Remove columns
+    const char* columnFiles[] = { "meta", "users", "uid", "value", "lat", "lon" };
+    for (int i = 0; i < 6; i++) 
+    {
+        sprintf(filePath, "./%s/columns.%s", huntId, columnFiles[i]);
+        unlink(filePath);
+    }
+    
     //Remove log file
     sprintf(filePath, "./%s/logged_hunt", huntId);
     unlink(filePath);
     
+    //Remove metadata
+    sprintf(filePath, "./%s/hunt.meta", huntId);
+    unlink(filePath);
+    unlockHunt(&lock);
+    
     //Remove directory
     if (rmdir(dirPath) == -1) 
     {
@@ -375,26 +1155,76 @@ void removeHunt(char* huntId)
 
 int main(int argc, char *argv[]) 
 {
+    //Pull global options out of the argument list
+    int kept = 1;
+    int showStats = 0;
+    for (int i = 1; i < argc; i++) 
+    {
+        if (strcmp(argv[i], "--stats") == 0) 
+        {
+            showStats = 1;
+            continue;
+        }
+        if (strncmp(argv[i], "--format=", 9) == 0) 
+        {
+            if (parseOutputFormat(argv[i] + 9, &outputFormat) == -1) 
+            {
+                printf("Unknown format: %s (use text, json, ndjson or binary)\n", argv[i] + 9);
+                return 1;
+            }
+            continue;
+        }
+        if (strncmp(argv[i], "--sync=", 7) == 0) 
+        {
+            if (parseLogSyncMode(argv[i] + 7, &logSyncMode) == -1) 
+            {
+                printf("Unknown sync mode: %s (use none, batch or entry)\n", argv[i] + 7);
+                return 1;
+            }
+            continue;
+        }
+        argv[kept++] = argv[i];
+    }
+    argc = kept;
+    
     if (argc < 3) 
     {
-        printf("Usage: %s --operation hunt_id [treasure_id]\n", argv[0]);
+        printf("Usage: %s [--sync=none|batch|entry] [--format=text|json|ndjson|binary] [--stats] "
+               "--operation hunt_id [treasure_id]\n", argv[0]);
         return 1;
     }
 
     char* operation = argv[1];
     char* huntId = argv[2];
     
+    //The operation is counted under its name without the dashes
+    StatsTimer timer;
+    beginOperation(&timer, operation + strspn(operation, "-"));
+    
     if (strcmp(operation, "--add") == 0) 
     {
         addTreasure(huntId);
     } 
+    else if (strcmp(operation, "--add-batch") == 0) 
+    {
+        addTreasureBatch(huntId, argc >= 4 ? argv[3] : "-");
+    } 
     else if (strcmp(operation, "--list") == 0) 
     {
-        listTreasures(huntId);
+        TreasureQuery query;
+        initTreasureQuery(&query);
+        query.format = outputFormat;
+        if (parseTreasureQuery(&query, argc - 3, argv + 3) == -1) 
+        {
+            printf("Usage: %s --list hunt_id [--offset N] [--limit N] [user=NAME] ['value>=N'] "
+                   "[bbox=MIN_LAT,MIN_LON,MAX_LAT,MAX_LON] [--compact] [--format=FORMAT]\n", argv[0]);
+            return 1;
+        }
+        listTreasures(huntId, &query);
     } 
     else if (strcmp(operation, "--view") == 0) 
     {
-        viewTreasure(huntId);
+        viewTreasure(huntId, argc >= 4 ? argv[3] : NULL);
     } 
     else if (strcmp(operation, "--remove_treasure") == 0) 
     {
@@ -405,6 +1235,32 @@ int main(int argc, char *argv[])
         }
         removeTreasure(huntId, argv[3]);
     }
+    else if (strcmp(operation, "--near") == 0) 
+    {
+        if (argc < 6) 
+        {
+            printf("Usage: %s --near hunt_id latitude longitude radius_m\n", argv[0]);
+            return 1;
+        }
+        nearTreasures(huntId, argv[3], argv[4], argv[5]);
+    }
+    else if (strcmp(operation, "--bbox") == 0) 
+    {
+        if (argc < 7) 
+        {
+            printf("Usage: %s --bbox hunt_id min_lat min_lon max_lat max_lon\n", argv[0]);
+            return 1;
+        }
+        boxTreasures(huntId, argv[3], argv[4], argv[5], argv[6]);
+    }
+    else if (strcmp(operation, "--compact") == 0) 
+    {
+        compactHunt(huntId);
+    }
+    else if (strcmp(operation, "--migrate") == 0) 
+    {
+        migrateHunt(huntId);
+    }
     else if (strcmp(operation, "--remove_hunt") == 0) 
     {
         removeHunt(huntId);
@@ -415,5 +1271,13 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    closeHuntLog(&huntLog);
+    endOperation(&timer);
+    
+    //Counters go to stderr, stdout keeps the operation's own output
+    if (showStats) 
+    {
+        printOperationStats(stderr);
+    }
     return 0;
 }
\ No newline at end of file
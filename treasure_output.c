@@ -0,0 +1,133 @@
+#include <string.h>
+#include <math.h>
+
+#include "treasure_output.h"
+
+int parseOutputFormat(const char* name, OutputFormat* format)
+{
+    static const char* names[] = {"text", "json", "ndjson", "binary"};
+    for (int i = 0; i < 4; i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            *format = (OutputFormat)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+char* appendJsonString(char* out, const char* text)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    *out++ = '"';
+    for (const unsigned char* c = (const unsigned char*)text; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            *out++ = '\\';
+            *out++ = *c;
+        }
+        else if (*c < 0x20)
+        {
+            //Control characters as \u00XX, bytes from 0x80 up pass as UTF-8
+            memcpy(out, "\\u00", 4);
+            out[4] = hex[*c >> 4];
+            out[5] = hex[*c & 0xf];
+            out += 6;
+        }
+        else
+        {
+            *out++ = *c;
+        }
+    }
+    *out++ = '"';
+    return out;
+}
+
+//Digits of value, at least minDigits of them (zero padded)
+static char* appendDigits(char* out, unsigned long long value, int minDigits)
+{
+    char digits[24];
+    int count = 0;
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0 || count < minDigits);
+
+    while (count > 0)
+    {
+        *out++ = digits[--count];
+    }
+    return out;
+}
+
+char* appendJsonInt(char* out, long long value)
+{
+    unsigned long long magnitude = value;
+    if (value < 0)
+    {
+        *out++ = '-';
+        magnitude = -magnitude;
+    }
+    return appendDigits(out, magnitude, 1);
+}
+
+char* appendJsonFixed(char* out, double value, int decimals)
+{
+    //JSON has no NaN or infinity
+    if (!isfinite(value))
+    {
+        memcpy(out, "null", 4);
+        return out + 4;
+    }
+
+    unsigned long long scale = 1;
+    for (int i = 0; i < decimals; i++)
+    {
+        scale *= 10;
+    }
+    //Ties go to even, as printf() does; a float times 10^6 is exact in a
+    //double, so coordinates print exactly as in the text output
+    unsigned long long units = llrint(fabs(value) * scale);
+
+    if (value < 0 && units != 0)
+    {
+        *out++ = '-';
+    }
+    out = appendDigits(out, units / scale, 1);
+    if (decimals > 0)
+    {
+        *out++ = '.';
+        out = appendDigits(out, units % scale, decimals);
+    }
+    return out;
+}
+
+size_t formatTreasureJson(const Treasure* treasure, char* out)
+{
+    char* end = out;
+    memcpy(end, "{\"id\":", 6);
+    end = appendJsonInt(end + 6, treasure->treasureId);
+    memcpy(end, ",\"user\":", 8);
+    end = appendJsonString(end + 8, treasure->userName);
+    memcpy(end, ",\"latitude\":", 12);
+    end = appendJsonFixed(end + 12, treasure->latitude, 6);
+    memcpy(end, ",\"longitude\":", 13);
+    end = appendJsonFixed(end + 13, treasure->longitude, 6);
+    memcpy(end, ",\"value\":", 9);
+    end = appendJsonInt(end + 9, treasure->value);
+    memcpy(end, ",\"clue\":", 8);
+    end = appendJsonString(end + 8, treasure->clueText);
+    *end++ = '}';
+    return end - out;
+}
+
+int writeTreasureRecord(FILE* out, const Treasure* treasure)
+{
+    unsigned char record[TREASURE_RECORD_MAX];
+    size_t length = encodeTreasure(treasure, record);
+    return fwrite(record, 1, length, out) == length ? 0 : -1;
+}
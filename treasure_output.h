@@ -0,0 +1,40 @@
+#ifndef TREASURE_OUTPUT_H
+#define TREASURE_OUTPUT_H
+
+#include <stdio.h>
+
+#include "treasure.h"
+
+//How listings and reports are written:
+//  text    the usual human readable output
+//  json    one JSON document
+//  ndjson  one JSON object per line
+//  binary  raw records: treasures in the version 2 on-disk record format,
+//          scores as ScoreRecord structs (score_hunt.h), host order
+typedef enum {
+    OUTPUT_TEXT,
+    OUTPUT_JSON,
+    OUTPUT_NDJSON,
+    OUTPUT_BINARY
+} OutputFormat;
+
+//Longest JSON object formatTreasureJson() can produce, every byte of the
+//user name and clue escaped
+#define TREASURE_JSON_MAX (128 + 6 * (49 + 199))
+
+//Parse a format name. Returns 0, or -1 if the name is not known.
+int parseOutputFormat(const char* name, OutputFormat* format);
+
+//JSON building blocks. Each writes at out and returns the position just
+//past what it wrote; nothing is NUL terminated.
+char* appendJsonString(char* out, const char* text);
+char* appendJsonInt(char* out, long long value);
+char* appendJsonFixed(char* out, double value, int decimals);
+
+//A treasure as one JSON object, without a newline. Returns its length.
+size_t formatTreasureJson(const Treasure* treasure, char* out);
+
+//Write a treasure in the version 2 on-disk record format
+int writeTreasureRecord(FILE* out, const Treasure* treasure);
+
+#endif
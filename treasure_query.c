@@ -0,0 +1,350 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+
+#include "treasure_query.h"
+#include "treasure_index.h"
+#include "treasure_stats.h"
+
+void initTreasureQuery(TreasureQuery* query)
+{
+    memset(query, 0, sizeof(*query));
+    query->limit = -1;
+}
+
+static int parseCount(const char* text, long* count)
+{
+    char* end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || value < 0)
+    {
+        return -1;
+    }
+    *count = value;
+    return 0;
+}
+
+int parseTreasureQuery(TreasureQuery* query, int argc, char** argv)
+{
+    for (int i = 0; i < argc; i++)
+    {
+        char* arg = argv[i];
+        char* end;
+
+        if (strcmp(arg, "--compact") == 0)
+        {
+            query->compact = 1;
+        }
+        else if (strcmp(arg, "--offset") == 0 || strcmp(arg, "--limit") == 0)
+        {
+            long* count = arg[2] == 'o' ? &query->offset : &query->limit;
+            if (i + 1 >= argc || parseCount(argv[++i], count) == -1)
+            {
+                return -1;
+            }
+        }
+        else if (strncmp(arg, "--offset=", 9) == 0)
+        {
+            if (parseCount(arg + 9, &query->offset) == -1)
+            {
+                return -1;
+            }
+        }
+        else if (strncmp(arg, "--limit=", 8) == 0)
+        {
+            if (parseCount(arg + 8, &query->limit) == -1)
+            {
+                return -1;
+            }
+        }
+        else if (strncmp(arg, "--format=", 9) == 0)
+        {
+            if (parseOutputFormat(arg + 9, &query->format) == -1)
+            {
+                return -1;
+            }
+        }
+        else if (strncmp(arg, "user=", 5) == 0)
+        {
+            if (arg[5] == '\0' || strlen(arg + 5) >= sizeof(query->userName))
+            {
+                return -1;
+            }
+            strcpy(query->userName, arg + 5);
+            query->hasUser = 1;
+        }
+        else if (strncmp(arg, "value>=", 7) == 0)
+        {
+            errno = 0;
+            query->minValue = strtol(arg + 7, &end, 10);
+            if (errno != 0 || end == arg + 7 || *end != '\0')
+            {
+                return -1;
+            }
+            query->hasMinValue = 1;
+        }
+        else if (strncmp(arg, "bbox=", 5) == 0)
+        {
+            int used = 0;
+            if (sscanf(arg + 5, "%f,%f,%f,%f%n", &query->minLat, &query->minLon,
+                       &query->maxLat, &query->maxLon, &used) != 4 || arg[5 + used] != '\0')
+            {
+                return -1;
+            }
+            query->hasBox = 1;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int parseTreasureQueryText(TreasureQuery* query, const char* text)
+{
+    char copy[256];
+    if (strlen(text) >= sizeof(copy))
+    {
+        return -1;
+    }
+    strcpy(copy, text);
+
+    char* args[64];
+    int count = 0;
+    for (char* token = strtok(copy, " \t\r\n"); token != NULL; token = strtok(NULL, " \t\r\n"))
+    {
+        if (count == 64)
+        {
+            return -1;
+        }
+        args[count++] = token;
+    }
+    return parseTreasureQuery(query, count, args);
+}
+
+int treasureMatchesQuery(const Treasure* treasure, const TreasureQuery* query)
+{
+    if (query->hasMinValue && treasure->value < query->minValue)
+    {
+        return 0;
+    }
+    if (query->hasBox &&
+        (treasure->latitude < query->minLat || treasure->latitude > query->maxLat ||
+         treasure->longitude < query->minLon || treasure->longitude > query->maxLon))
+    {
+        return 0;
+    }
+    if (query->hasUser && strcmp(treasure->userName, query->userName) != 0)
+    {
+        return 0;
+    }
+    return 1;
+}
+
+//Records map one to one onto listed treasures when nothing is filtered
+//out and the hunt has no removed records. Returns 1 then, with the
+//(fresh) index header of the hunt.
+static int isUnfiltered(const char* huntId, const TreasureQuery* query, TreasureIndexHeader* header)
+{
+    int lastId;
+    return !query->hasUser && !query->hasMinValue && !query->hasBox &&
+           getTreasureIndexInfo(huntId, header, &lastId) == 0 && header->deletedCount == 0;
+}
+
+//Move an unfiltered reader past the first query->offset records without
+//reading them. Returns how many treasures were skipped.
+static long seekToOffset(TreasureReader* reader, const char* huntId, const TreasureQuery* query,
+                         const TreasureIndexHeader* header)
+{
+    if (query->offset >= header->entryCount)
+    {
+        limitTreasureReader(reader, reader->end, reader->end);
+        return query->offset;
+    }
+
+    //Legacy records have a fixed size; current ones are found through the
+    //index, whose entries do
+    off_t start;
+    if (reader->version == 1)
+    {
+        start = (off_t)query->offset * sizeof(Treasure);
+    }
+    else if (getTreasureOffsetAt(huntId, (int)query->offset, &start) == -1)
+    {
+        return 0;
+    }
+    limitTreasureReader(reader, start, reader->end);
+    return query->offset;
+}
+
+//Copy the records in [start, end) of the treasures file to out unchanged.
+//sendfile() moves them from the page cache without passing through this
+//process; streams without a descriptor (and outputs sendfile() refuses)
+//get them through the mapping or pread().
+static int copyRecordRange(FILE* out, TreasureReader* reader, off_t start, off_t end)
+{
+    int outFd = fileno(out);
+    if (start < end && outFd != -1 && fflush(out) == 0)
+    {
+        while (start < end)
+        {
+            ssize_t n = sendfile(outFd, reader->fd, &start, end - start);
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                break;
+            }
+        }
+    }
+
+    if (start < end && reader->map != NULL)
+    {
+        return fwrite(reader->map + start, 1, end - start, out) == (size_t)(end - start) ? 0 : -1;
+    }
+
+    unsigned char buffer[65536];
+    while (start < end)
+    {
+        size_t wanted = end - start < (off_t)sizeof(buffer) ? (size_t)(end - start) : sizeof(buffer);
+        ssize_t n = pread(reader->fd, buffer, wanted, start);
+        if (n <= 0 || fwrite(buffer, 1, n, out) != (size_t)n)
+        {
+            return -1;
+        }
+        statsTally.bytesRead += n;
+        start += n;
+    }
+    return 0;
+}
+
+//Binary listing of an unfiltered hunt: the records wanted are one byte
+//range of the file, sent without decoding any of them
+static long copyUnfiltered(FILE* out, TreasureReader* reader, const char* huntId,
+                           const TreasureQuery* query, const TreasureIndexHeader* header)
+{
+    long available = header->entryCount > query->offset ? header->entryCount - query->offset : 0;
+    long count = query->limit != -1 && query->limit < available ? query->limit : available;
+
+    off_t end = reader->end;
+    if (count < available && getTreasureOffsetAt(huntId, (int)(query->offset + count), &end) == -1)
+    {
+        return -1;
+    }
+    if (end > reader->end)
+    {
+        end = reader->end;
+    }
+
+    copyRecordRange(out, reader, reader->position, end);
+    return count;
+}
+
+long printTreasureQuery(FILE* out, TreasureReader* reader, const char* huntId, const TreasureQuery* query)
+{
+    long skipped = 0;
+    TreasureIndexHeader header;
+    if ((query->offset > 0 || query->format == OUTPUT_BINARY) && isUnfiltered(huntId, query, &header))
+    {
+        skipped = seekToOffset(reader, huntId, query, &header);
+        if (skipped == query->offset && query->format == OUTPUT_BINARY && reader->version != 1)
+        {
+            long copied = copyUnfiltered(out, reader, huntId, query, &header);
+            if (copied != -1)
+            {
+                return copied;
+            }
+        }
+    }
+
+    long shown = 0;
+    const Treasure* treasure;
+    char json[TREASURE_JSON_MAX + 2];
+    off_t runStart = 0;
+    off_t runEnd = 0;  //binary output: matching records not copied yet
+
+    if (query->format == OUTPUT_JSON)
+    {
+        fputc('[', out);
+    }
+
+    while ((query->limit == -1 || shown < query->limit) && (treasure = nextTreasure(reader)) != NULL)
+    {
+        //Removed treasures stay in the file until it is compacted
+        if (TREASURE_IS_DELETED(treasure) || !treasureMatchesQuery(treasure, query))
+        {
+            continue;
+        }
+        if (skipped < query->offset)
+        {
+            skipped++;
+            continue;
+        }
+
+        if (query->format == OUTPUT_JSON || query->format == OUTPUT_NDJSON)
+        {
+            size_t length = 0;
+            if (query->format == OUTPUT_JSON)
+            {
+                if (shown > 0)
+                {
+                    json[length++] = ',';
+                }
+                json[length++] = '\n';
+            }
+            length += formatTreasureJson(treasure, json + length);
+            if (query->format == OUTPUT_NDJSON)
+            {
+                json[length++] = '\n';
+            }
+            fwrite(json, 1, length, out);
+        }
+        else if (query->format == OUTPUT_BINARY)
+        {
+            //Adjacent records go out as one range; legacy ones are re-encoded
+            if (reader->version == 1)
+            {
+                writeTreasureRecord(out, treasure);
+            }
+            else if (runEnd == reader->recordOffset && runEnd != 0)
+            {
+                runEnd = reader->position;
+            }
+            else
+            {
+                copyRecordRange(out, reader, runStart, runEnd);
+                runStart = reader->recordOffset;
+                runEnd = reader->position;
+            }
+        }
+        else if (query->compact)
+        {
+            fprintf(out, "%d\t%s\t%.6f\t%.6f\t%d\t%s\n", treasure->treasureId, treasure->userName,
+                    treasure->latitude, treasure->longitude, treasure->value, treasure->clueText);
+        }
+        else
+        {
+            fprintf(out, "ID: %d\nUser: %s\nLocation: %.6f, %.6f\nClue: %s\nValue: %d\n-------------------\n",
+                    treasure->treasureId, treasure->userName, treasure->latitude, treasure->longitude,
+                    treasure->clueText, treasure->value);
+        }
+        shown++;
+    }
+
+    if (query->format == OUTPUT_JSON)
+    {
+        fputs(shown == 0 ? "]\n" : "\n]\n", out);
+    }
+    else if (query->format == OUTPUT_BINARY)
+    {
+        copyRecordRange(out, reader, runStart, runEnd);
+    }
+
+    return shown;
+}
@@ -0,0 +1,54 @@
+#ifndef TREASURE_QUERY_H
+#define TREASURE_QUERY_H
+
+#include <stdio.h>
+
+#include "treasure.h"
+#include "treasure_reader.h"
+#include "treasure_output.h"
+
+//Buffer given to stdout before a listing, so records leave in large writes
+#define TREASURE_QUERY_BUFFER (1 << 20)
+
+//Which treasures of a hunt a listing shows, and how. Filters are checked
+//while the file is scanned; offset and limit count matching treasures.
+typedef struct {
+    long offset;
+    long limit;  //-1 for no limit
+    int hasUser;
+    char userName[50];
+    int hasMinValue;
+    int minValue;
+    int hasBox;
+    float minLat;
+    float minLon;
+    float maxLat;
+    float maxLon;
+    int compact;  //one line per treasure instead of a block
+    OutputFormat format;
+} TreasureQuery;
+
+//Query that lists every treasure in the usual block format
+void initTreasureQuery(TreasureQuery* query);
+
+//Apply listing options to a query:
+//  --offset N, --limit N (or --offset=N, --limit=N), --compact,
+//  --format=text|json|ndjson|binary,
+//  user=NAME, value>=N, bbox=MIN_LAT,MIN_LON,MAX_LAT,MAX_LON
+//Returns 0, or -1 at the first option that is not understood.
+int parseTreasureQuery(TreasureQuery* query, int argc, char** argv);
+
+//Same, with the options as whitespace separated text
+int parseTreasureQueryText(TreasureQuery* query, const char* text);
+
+//1 if the treasure passes the query's filters
+int treasureMatchesQuery(const Treasure* treasure, const TreasureQuery* query);
+
+//Print the live treasures of a hunt that match the query, in file order,
+//reading them from an open reader. Without filters the offset is reached
+//by seeking instead of scanning. A JSON listing is one array; a binary
+//listing copies the records straight from the file when out has a file
+//descriptor. Returns how many treasures were printed.
+long printTreasureQuery(FILE* out, TreasureReader* reader, const char* huntId, const TreasureQuery* query);
+
+#endif
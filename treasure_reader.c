@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "treasure_reader.h"
+#include "treasure_stats.h"
+
+#define READER_WINDOW 65536
+
+int openTreasureReader(TreasureReader* reader, const char* path)
+{
+    memset(reader, 0, sizeof(*reader));
+
+    reader->fd = open(path, O_RDONLY);
+    if (reader->fd == -1)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(reader->fd, &st) == -1)
+    {
+        close(reader->fd);
+        return -1;
+    }
+    reader->fileSize = st.st_size;
+
+    TreasureFileHeader header;
+    if (readTreasureFileHeader(reader->fd, &header) == 2)
+    {
+        reader->version = header.version;
+        reader->dataStart = header.headerSize;
+        reader->end = st.st_size;
+    }
+    else
+    {
+        //Legacy file: only whole structs count, a torn tail is ignored
+        reader->version = 1;
+        reader->dataStart = 0;
+        reader->end = st.st_size / sizeof(Treasure) * sizeof(Treasure);
+    }
+    reader->position = reader->dataStart;
+    if (reader->end <= reader->dataStart)
+    {
+        return 0;
+    }
+
+    void* map = mmap(NULL, reader->end, PROT_READ, MAP_SHARED, reader->fd, 0);
+    if (map == MAP_FAILED)
+    {
+        //Fall back to pread() through a window
+        reader->window = malloc(READER_WINDOW);
+        if (reader->window == NULL)
+        {
+            close(reader->fd);
+            return -1;
+        }
+        return 0;
+    }
+
+    madvise(map, reader->end, MADV_SEQUENTIAL);
+    reader->map = map;
+    reader->mapLength = reader->end;
+
+    return 0;
+}
+
+void limitTreasureReader(TreasureReader* reader, off_t start, off_t end)
+{
+    if (end < reader->end)
+    {
+        reader->end = end;
+    }
+    reader->position = start > reader->dataStart ? start : reader->dataStart;
+}
+
+//Bytes available from offset on (at most one record's worth in the
+//fallback case), or NULL past the end
+static const unsigned char* bytesAt(TreasureReader* reader, off_t offset, size_t* available)
+{
+    if (offset >= reader->end)
+    {
+        return NULL;
+    }
+    *available = reader->end - offset;
+
+    if (reader->map != NULL)
+    {
+        return reader->map + offset;
+    }
+
+    //Slide the window when the record might cross its end
+    size_t wanted = *available < sizeof(Treasure) ? *available : sizeof(Treasure);
+    if (offset < reader->windowStart || offset + wanted > reader->windowStart + reader->windowLength)
+    {
+        size_t total = 0;
+        while (total < READER_WINDOW)
+        {
+            ssize_t n = pread(reader->fd, reader->window + total, READER_WINDOW - total, offset + total);
+            if (n <= 0)
+            {
+                break;
+            }
+            total += n;
+            statsTally.bytesRead += n;
+        }
+        reader->windowStart = offset;
+        reader->windowLength = total;
+    }
+
+    size_t inWindow = reader->windowStart + reader->windowLength - offset;
+    if (inWindow < *available)
+    {
+        *available = inWindow;
+    }
+    return reader->window + (offset - reader->windowStart);
+}
+
+//Decode the record at offset into reader->current, returns its length or 0
+static size_t decodeAt(TreasureReader* reader, off_t offset)
+{
+    size_t available;
+    const unsigned char* bytes = bytesAt(reader, offset, &available);
+    if (bytes == NULL)
+    {
+        return 0;
+    }
+
+    size_t length;
+    if (reader->version == 1)
+    {
+        if (available < sizeof(Treasure))
+        {
+            return 0;
+        }
+        memcpy(&reader->current, bytes, sizeof(Treasure));
+        length = sizeof(Treasure);
+    }
+    else if ((length = decodeTreasure(bytes, available, &reader->current)) == 0)
+    {
+        return 0;
+    }
+
+    //Mapped bytes count as read once decoded, window bytes when fetched
+    statsTally.recordsScanned++;
+    if (reader->map != NULL)
+    {
+        statsTally.bytesRead += length;
+    }
+    return length;
+}
+
+const Treasure* nextTreasure(TreasureReader* reader)
+{
+    size_t length = decodeAt(reader, reader->position);
+    if (length == 0)
+    {
+        return NULL;
+    }
+
+    reader->recordOffset = reader->position;
+    reader->position += length;
+    return &reader->current;
+}
+
+const Treasure* treasureAt(TreasureReader* reader, off_t offset)
+{
+    if (offset < reader->dataStart ||
+        (reader->version == 1 && offset % sizeof(Treasure) != 0) ||
+        decodeAt(reader, offset) == 0)
+    {
+        return NULL;
+    }
+
+    reader->recordOffset = offset;
+    return &reader->current;
+}
+
+void closeTreasureReader(TreasureReader* reader)
+{
+    if (reader->map != NULL)
+    {
+        munmap((void*)reader->map, reader->mapLength);
+    }
+    free(reader->window);
+    if (reader->fd != -1)
+    {
+        close(reader->fd);
+    }
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = -1;
+}
@@ -0,0 +1,45 @@
+#ifndef TREASURE_READER_H
+#define TREASURE_READER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "treasure.h"
+
+//Sequential reader over a treasures file, current or legacy format. The
+//file is mapped once and walked in place; when it cannot be mapped (empty
+//file, mmap failure) it is read through a large pread window instead.
+//A torn trailing record is never returned.
+typedef struct {
+    int fd;
+    int version;  //TREASURE_FORMAT_VERSION, or 1 for raw Treasure structs
+    off_t fileSize;
+    off_t dataStart;  //offset of the first record
+    off_t end;  //reading stops here
+    off_t position;  //offset of the next record
+    off_t recordOffset;  //offset of the record returned last
+    const unsigned char* map;
+    size_t mapLength;
+    unsigned char* window;
+    off_t windowStart;
+    size_t windowLength;
+    Treasure current;
+} TreasureReader;
+
+//Open the treasures file at path. Returns 0 on success, -1 on error.
+int openTreasureReader(TreasureReader* reader, const char* path);
+
+//Restrict the reader to records starting in [start, end). start must be
+//the offset of a record (as kept by the ID index), so several readers
+//can split one file into record-aligned ranges.
+void limitTreasureReader(TreasureReader* reader, off_t start, off_t end);
+
+//Next record in file order, removed records included, or NULL at the end
+const Treasure* nextTreasure(TreasureReader* reader);
+
+//Record starting at a byte offset, or NULL if there is no whole record there
+const Treasure* treasureAt(TreasureReader* reader, off_t offset);
+
+void closeTreasureReader(TreasureReader* reader);
+
+#endif
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "treasure_stats.h"
+
+__thread StatsTally statsTally;
+
+static OperationStats operations[STATS_MAX_OPERATIONS];
+static atomic_int operationCount;
+static pthread_mutex_t registerLock = PTHREAD_MUTEX_INITIALIZER;
+
+static OperationStats* lookupOperation(const char* name, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(operations[i].name, name) == 0)
+        {
+            return &operations[i];
+        }
+    }
+    return NULL;
+}
+
+OperationStats* findOperationStats(const char* name)
+{
+    //Names are only ever added, and a name is complete before the count
+    //that publishes it, so lookups need no lock
+    int count = atomic_load_explicit(&operationCount, memory_order_acquire);
+    OperationStats* operation = lookupOperation(name, count);
+    if (operation != NULL)
+    {
+        return operation;
+    }
+
+    pthread_mutex_lock(&registerLock);
+    count = atomic_load_explicit(&operationCount, memory_order_relaxed);
+    operation = lookupOperation(name, count);
+    if (operation == NULL && count < STATS_MAX_OPERATIONS)
+    {
+        operation = &operations[count];
+        snprintf(operation->name, sizeof(operation->name), "%s", name);
+        atomic_store_explicit(&operationCount, count + 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&registerLock);
+
+    return operation;
+}
+
+void beginOperation(StatsTimer* timer, const char* name)
+{
+    timer->operation = findOperationStats(name);
+    timer->before = statsTally;
+    clock_gettime(CLOCK_MONOTONIC, &timer->start);
+}
+
+void endOperation(StatsTimer* timer)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    OperationStats* operation = timer->operation;
+    if (operation == NULL)
+    {
+        return;
+    }
+
+    unsigned long long nanos = (now.tv_sec - timer->start.tv_sec) * 1000000000ULL +
+                               now.tv_nsec - timer->start.tv_nsec;
+    int bucket = nanos == 0 ? 0 : 63 - __builtin_clzll(nanos);
+    if (bucket >= STATS_LATENCY_BUCKETS)
+    {
+        bucket = STATS_LATENCY_BUCKETS - 1;
+    }
+
+    atomic_fetch_add_explicit(&operation->calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&operation->bytesRead,
+                              statsTally.bytesRead - timer->before.bytesRead, memory_order_relaxed);
+    atomic_fetch_add_explicit(&operation->recordsScanned,
+                              statsTally.recordsScanned - timer->before.recordsScanned, memory_order_relaxed);
+    atomic_fetch_add_explicit(&operation->syscalls,
+                              statsTally.syscalls - timer->before.syscalls, memory_order_relaxed);
+    atomic_fetch_add_explicit(&operation->totalNanos, nanos, memory_order_relaxed);
+    atomic_fetch_add_explicit(&operation->latency[bucket], 1, memory_order_relaxed);
+
+    unsigned long long slowest = atomic_load_explicit(&operation->maxNanos, memory_order_relaxed);
+    while (nanos > slowest &&
+           !atomic_compare_exchange_weak_explicit(&operation->maxNanos, &slowest, nanos,
+                                                  memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+}
+
+//Upper bound of the bucket holding the given share of the calls, in ms,
+//but never above the slowest call
+static double latencyPercentile(OperationStats* operation, unsigned long long calls,
+                                unsigned long long maxNanos, double share)
+{
+    unsigned long long wanted = (unsigned long long)(calls * share);
+    unsigned long long seen = 0;
+    unsigned long long bound = maxNanos;
+    for (int bucket = 0; bucket < STATS_LATENCY_BUCKETS; bucket++)
+    {
+        seen += atomic_load_explicit(&operation->latency[bucket], memory_order_relaxed);
+        if (seen > wanted)
+        {
+            bound = 2ULL << bucket;
+            break;
+        }
+    }
+    return (bound < maxNanos ? bound : maxNanos) / 1e6;
+}
+
+void printOperationStats(FILE* out)
+{
+    int count = atomic_load_explicit(&operationCount, memory_order_acquire);
+    if (count == 0)
+    {
+        fprintf(out, "No operations recorded yet.\n");
+        return;
+    }
+
+    fprintf(out, "%-16s %8s %10s %10s %10s %10s %12s %10s %9s\n", "operation", "calls",
+            "avg ms", "p50 ms", "p99 ms", "max ms", "bytes read", "records", "syscalls");
+    for (int i = 0; i < count; i++)
+    {
+        OperationStats* operation = &operations[i];
+        unsigned long long calls = atomic_load_explicit(&operation->calls, memory_order_relaxed);
+        if (calls == 0)
+        {
+            continue;
+        }
+        unsigned long long totalNanos = atomic_load_explicit(&operation->totalNanos, memory_order_relaxed);
+        unsigned long long maxNanos = atomic_load_explicit(&operation->maxNanos, memory_order_relaxed);
+
+        fprintf(out, "%-16s %8llu %10.3f %10.3f %10.3f %10.3f %12llu %10llu %9llu\n",
+                operation->name, calls, totalNanos / 1e6 / calls,
+                latencyPercentile(operation, calls, maxNanos, 0.50),
+                latencyPercentile(operation, calls, maxNanos, 0.99),
+                maxNanos / 1e6,
+                atomic_load_explicit(&operation->bytesRead, memory_order_relaxed),
+                atomic_load_explicit(&operation->recordsScanned, memory_order_relaxed),
+                atomic_load_explicit(&operation->syscalls, memory_order_relaxed));
+    }
+}
+
+//System call counting. The programs are linked with --wrap for each call
+//below (SYSCALL_WRAPS in the Makefile), so every direct call, wherever it
+//is made, lands here first and counts once. Calls the C library makes on
+//its own behalf (stdio buffer flushes, directory streams) are not seen.
+#define COUNTED_CALL(type, name, params, args) \
+    type __real_##name params;                   \
+    type __wrap_##name params                    \
+    {                                            \
+        statsTally.syscalls++;                   \
+        return __real_##name args;               \
+    }
+
+COUNTED_CALL(int, close, (int fd), (fd))
+COUNTED_CALL(ssize_t, read, (int fd, void* buffer, size_t length), (fd, buffer, length))
+COUNTED_CALL(ssize_t, write, (int fd, const void* buffer, size_t length), (fd, buffer, length))
+COUNTED_CALL(ssize_t, pread, (int fd, void* buffer, size_t length, off_t offset), (fd, buffer, length, offset))
+COUNTED_CALL(ssize_t, pwrite, (int fd, const void* buffer, size_t length, off_t offset),
+             (fd, buffer, length, offset))
+COUNTED_CALL(ssize_t, writev, (int fd, const struct iovec* iov, int count), (fd, iov, count))
+COUNTED_CALL(ssize_t, sendfile, (int out, int in, off_t* offset, size_t length), (out, in, offset, length))
+COUNTED_CALL(ssize_t, sendmsg, (int fd, const struct msghdr* message, int flags), (fd, message, flags))
+COUNTED_CALL(int, fstat, (int fd, struct stat* st), (fd, st))
+COUNTED_CALL(int, stat, (const char* path, struct stat* st), (path, st))
+COUNTED_CALL(int, fsync, (int fd), (fd))
+COUNTED_CALL(int, fdatasync, (int fd), (fd))
+COUNTED_CALL(int, fchmod, (int fd, mode_t mode), (fd, mode))
+COUNTED_CALL(int, mkdir, (const char* path, mode_t mode), (path, mode))
+COUNTED_CALL(int, rmdir, (const char* path), (path))
+COUNTED_CALL(int, rename, (const char* from, const char* to), (from, to))
+COUNTED_CALL(int, unlink, (const char* path), (path))
+COUNTED_CALL(int, symlink, (const char* target, const char* path), (target, path))
+COUNTED_CALL(ssize_t, readlink, (const char* path, char* buffer, size_t length), (path, buffer, length))
+COUNTED_CALL(int, mkstemp, (char* pattern), (pattern))
+COUNTED_CALL(void*, mmap, (void* address, size_t length, int protection, int flags, int fd, off_t offset),
+             (address, length, protection, flags, fd, offset))
+COUNTED_CALL(int, munmap, (void* address, size_t length), (address, length))
+COUNTED_CALL(int, madvise, (void* address, size_t length, int advice), (address, length, advice))
+COUNTED_CALL(int, dup2, (int fd, int target), (fd, target))
+COUNTED_CALL(int, pipe, (int fds[2]), (fds))
+COUNTED_CALL(int, poll, (struct pollfd* fds, nfds_t count, int timeout), (fds, count, timeout))
+
+//open and fcntl take an optional third argument
+int __real_open(const char* path, int flags, ...);
+int __wrap_open(const char* path, int flags, ...)
+{
+    mode_t mode = 0;
+    if (flags & O_CREAT)
+    {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, mode_t);
+        va_end(args);
+    }
+    statsTally.syscalls++;
+    return __real_open(path, flags, mode);
+}
+
+int __real_fcntl(int fd, int command, ...);
+int __wrap_fcntl(int fd, int command, ...)
+{
+    va_list args;
+    va_start(args, command);
+    void* argument = va_arg(args, void*);
+    va_end(args);
+    statsTally.syscalls++;
+    return __real_fcntl(fd, command, argument);
+}
@@ -0,0 +1,61 @@
+#ifndef TREASURE_STATS_H
+#define TREASURE_STATS_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define STATS_MAX_OPERATIONS 32
+#define STATS_NAME_LENGTH 32
+
+//Latency histogram bucket b counts operations that took [2^b, 2^(b+1)) ns
+#define STATS_LATENCY_BUCKETS 40
+
+//What the current thread did so far. The hot paths (record decoding,
+//index lookups) bump these with plain increments, and system calls are
+//counted by the wrappers in treasure_stats.c; an operation folds its
+//share into the shared counters once, when it ends.
+typedef struct {
+    unsigned long long bytesRead;
+    unsigned long long recordsScanned;
+    unsigned long long syscalls;
+} StatsTally;
+
+extern __thread StatsTally statsTally;
+
+//Shared counters of one named operation. Updated with relaxed atomics,
+//so they can stay on all the time.
+typedef struct {
+    char name[STATS_NAME_LENGTH];
+    atomic_ullong calls;
+    atomic_ullong bytesRead;
+    atomic_ullong recordsScanned;
+    atomic_ullong syscalls;
+    atomic_ullong totalNanos;
+    atomic_ullong maxNanos;
+    atomic_ullong latency[STATS_LATENCY_BUCKETS];
+} OperationStats;
+
+//One operation in progress
+typedef struct {
+    OperationStats* operation;
+    struct timespec start;
+    StatsTally before;
+} StatsTimer;
+
+//Counters of an operation, registered on first use. Returns NULL once
+//STATS_MAX_OPERATIONS names are taken.
+OperationStats* findOperationStats(const char* name);
+
+//Start timing an operation on the current thread
+void beginOperation(StatsTimer* timer, const char* name);
+
+//Count the operation: one call, its latency and the tallies since begin
+void endOperation(StatsTimer* timer);
+
+//Table of every operation seen: calls, average/p50/p99/max latency (the
+//percentiles are histogram bucket bounds), bytes read, records scanned
+//and system calls
+void printOperationStats(FILE* out);
+
+#endif